@@ -4,7 +4,6 @@
 # At the moment, this has been tested under Raspbian (on a Pi 2 and a Pi 4) and Windows 10 (with MSYS2).
 #TODO: look for a local copy of Lua or SDL in the quig folder, for systems without pkg-config
 #TODO: does SDL need a similar set of names to check like Lua does?
-#TODO: add a nice way to build without SDL_mixer, it's not like sound is THAT important (in progress)
 
 echo "notice: quig build script started!"
 echo "notice: identifying Lua..."
@@ -29,23 +28,39 @@ else
 fi
 echo "notice: Lua detected as '$luaname'!"
 
-#enable or disable sound
-#if [ -z sound ]
-#then
-#sdl_libs=""
-#fi
+#Ogg Vorbis music is optional, WAV songs work without it
+if pkg-config vorbisfile
+then
+	echo "notice: Ogg Vorbis support enabled!"
+	vorbis_flags="-DQUIG_VORBIS $(pkg-config --libs --cflags vorbisfile)"
+else
+	echo "warning: libvorbisfile isn't installed, only WAV songs will work!"
+	vorbis_flags=""
+fi
 
 #set up compiler flags
 quig_outputname="quig"
-quig_libs=$(pkg-config --libs --cflags sdl2 SDL2_image SDL2_mixer "$luaname")
+quig_libs=$(pkg-config --libs --cflags sdl2 SDL2_image "$luaname")
+#this is a release build, so the debug log messages get left out (see QUIG_LOG_MAX in quig.cpp), take this out to get them back
+release_flags="-DNDEBUG"
 
 #build quig
 echo "notice: building quig..."
-if g++ quig.cpp -O2 -Wall -funsigned-char $quig_libs -o $quig_outputname
+if g++ quig.cpp Blip_Buffer.cpp -O2 -Wall -funsigned-char $release_flags $quig_libs $vorbis_flags -o $quig_outputname
 then
 	echo "notice: quig built!"
-	exit 0
 else
 	echo "fatal error: could not compile!"
 	exit 1
 fi
+
+#build the game packer
+echo "notice: building quigpak..."
+if g++ quigpak.cpp -O2 -Wall $quig_libs -o quigpak
+then
+	echo "notice: quigpak built!"
+	exit 0
+else
+	echo "fatal error: could not compile quigpak!"
+	exit 1
+fi
@@ -1,2 +1,2 @@
 #!/bin/sh
-apt install liblua5.3-dev libsdl2-dev libsdl2-image-dev libsdl2-mixer-dev
+apt install liblua5.3-dev libsdl2-dev libsdl2-image-dev libvorbis-dev
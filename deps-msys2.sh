@@ -1,3 +1,3 @@
 #!/bin/sh
 #this assumes you have g++ and pkg-config (TODO: honestly, this script should install that too, go find the package names+test from a clean install)
-pacman -S mingw-w64-i686-lua mingw-w64-i686-SDL2 mingw-w64-i686-SDL2_image mingw-w64-i686-SDL2_mixer
+pacman -S mingw-w64-i686-lua mingw-w64-i686-SDL2 mingw-w64-i686-SDL2_image mingw-w64-i686-libvorbis
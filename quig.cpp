@@ -20,10 +20,7 @@
 	* there's got to be an automated way to do header files in C++ -- cproto works for C, but gets confused with C++ declarations
 	* proper analog stick direction check -- it is way too easy to hit diagonal inputs on accident, we should check based on the angle rather than just an x/y check
 	* the GIF saving needs to show progress or something (maybe? on my current desktop, it's entirely seamless, but I remember it pausing badly on my laptop and the Pi)
-	* should refactor input handling, it's a mess and it doesn't need to be 
 	* really should give a look over the API so we don't do wild, breaking changes once we get to a not-beta release
-	  in particular, we should implement support for multiple controllers
-	  might just modify the API to take an optional controller parameter
 	* file reading/writing isn't particularly well tested at all and is potentially in flux
 	* user configurable deadzone for analog stick
 	* there are gaps in non-integer-scale text, should really just draw a little bit beyond the character if there's another character after (at least, for the filled modes of course)
@@ -50,9 +47,18 @@
 #include <SDL.h>
 #include <SDL_image.h>
 
-//#ifndef QUIG_NOSOUND
-//#include <SDL_mixer.h>
-//#endif
+#ifdef QUIG_VORBIS
+#include <vorbis/vorbisfile.h>
+#endif
+
+//SIMD for the sample mixer, there's a plain C++ version for everything else
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QUIG_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define QUIG_NEON
+#endif
 
 extern "C" {
 #include <lua.h>
@@ -60,158 +66,651 @@ extern "C" {
 #include <lauxlib.h>
 }
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 //#include <math.h>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <deque>
+#include <set>
+#include <new>
+#include <iterator>
+#include <time.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#endif
 #include "gif.h"
 #include "font8x8_basic.h"
 #include "font8x8_hiragana.h"
 #include "quig.h"
+#include "quigpak.h"
 #include "Blip_Buffer.h"
 
 //constants
 const char *QUIG_VERSION="1.2-beta1"; //version string -- major.minor-status
-const int QUIG_DEBUG = 1; //TODO: compile script flag for this
 const int FPS_RATE = 60; //quig runs at a fixed 60fps, period
 const int FPS_TICKS = (1000 / FPS_RATE);
 //screen res
 const int VIEW_WIDTH=240; //15 tiles, 30 characters
 const int VIEW_HEIGHT=144; //9 tiles, 18 characters
 
-//sound stuff
-const int NUM_CHANNELS = 8;
-const int AUDIO_MAX = 1; //31; //00-30 -- we're moving away from this
-bool sound_enabled=false; //is audio allowed?
-bool sound_active = false; //has sound been initialized?
-int sound_freq=48000;
-int buffer_len=2048;
-const int samples_frame = 800; //how many samples are in a typical frame
-int samples_frame_offset = 0; //how many samples +/- should we slop by to keep things in sync
-const int samples_frame_offset_max = 50; //how far can we slop before it's too much?
-SDL_AudioDeviceID audio_id=0;
-Sint16 audio_buffer[samples_frame + samples_frame_offset_max];
-Sint16 empty_buffer[samples_frame]; //guaranteed empty buffer
-
-//filename of game
-std::string arg_name;
-//the above, without the extension
-std::string base_name;
-/*
-#ifndef QUIG_NOSOUND
-//music
-struct quig_Music {
-	Mix_Music *mus=NULL; //loaded song
-	bool loaded=false; //we only try to play if we loaded
-	//load song into memory
-	void load(const char *filename) {
-		loaded=false;
-		mus=Mix_LoadMUS(filename);
-		if (mus) {
-			loaded=true;
+//SpscQueue -- fixed-size queue with exactly one thread pushing and one thread popping
+//there are no locks, so neither side ever has to wait on the other
+//holds up to N-1 items
+template<typename T, int N>
+struct SpscQueue {
+	T items[N];
+	SDL_atomic_t head; //next slot to write, only the producer changes this
+	SDL_atomic_t tail; //next slot to read, only the consumer changes this
+	SpscQueue() {
+		SDL_AtomicSet(&head, 0);
+		SDL_AtomicSet(&tail, 0);
+	}
+	//add an item, returns false if the queue is full
+	bool push(const T &item) {
+		int h=SDL_AtomicGet(&head);
+		int next=(h+1)%N;
+		if (next==SDL_AtomicGet(&tail)) {
+			return false;
 		}
+		items[h]=item;
+		SDL_AtomicSet(&head, next);
+		return true;
 	}
-	//play the song once
-	void play() {
-		if (sound_enabled && loaded) {
-			Mix_PlayMusic(mus, 1);
+	//remove the oldest item, returns false if there wasn't one
+	bool pop(T &item) {
+		int t=SDL_AtomicGet(&tail);
+		if (t==SDL_AtomicGet(&head)) {
+			return false;
 		}
+		item=items[t];
+		SDL_AtomicSet(&tail, (t+1)%N);
+		return true;
 	}
-	void playloop() {
-		if (sound_enabled && loaded) {
-			Mix_PlayMusic(mus, -1);
+	//(consumer side) throw away the oldest item, for when it was only peeked at
+	void drop() {
+		int t=SDL_AtomicGet(&tail);
+		if (t!=SDL_AtomicGet(&head)) {
+			SDL_AtomicSet(&tail, (t+1)%N);
 		}
 	}
-	//stop all music (TODO: does this get used anywhere?)
-	void stop() {
-		//Mix_HaltMusic();
-		Mix_PauseMusic();
-		Mix_RewindMusic();
+	//(consumer side) look at the oldest item without removing it, returns NULL if there isn't one
+	T* peek() {
+		int t=SDL_AtomicGet(&tail);
+		if (t==SDL_AtomicGet(&head)) {
+			return NULL;
+		}
+		return &items[t];
+	}
+	//how many items are waiting (only a snapshot if the other side is busy)
+	int count() {
+		return (SDL_AtomicGet(&head)-SDL_AtomicGet(&tail)+N)%N;
 	}
 };
-quig_Music songs[AUDIO_MAX];
-*/
-/*
-//samples
-struct quig_Sound {
-	Mix_Chunk *snd=NULL;
-	bool loaded=false;
-	//load the sound into memory
-	void load(const char *filename) {
-		loaded=false;
-		snd=Mix_LoadWAV(filename);
-		if (snd) {
-			loaded=true;
+
+//little-endian helpers for binary files
+void putU16(std::vector<Uint8> &out, Uint16 v) {
+	out.push_back(v & 0xFF);
+	out.push_back(v >> 8);
+}
+void putU32(std::vector<Uint8> &out, Uint32 v) {
+	putU16(out, v & 0xFFFF);
+	putU16(out, v >> 16);
+}
+void putU64(std::vector<Uint8> &out, Uint64 v) {
+	putU32(out, v & 0xFFFFFFFF);
+	putU32(out, v >> 32);
+}
+Uint16 getU16(const Uint8 *in) {
+	return in[0] | (in[1] << 8);
+}
+Uint32 getU32(const Uint8 *in) {
+	return getU16(in) | ((Uint32)getU16(in+2) << 16);
+}
+Uint64 getU64(const Uint8 *in) {
+	return getU32(in) | ((Uint64)getU32(in+4) << 32);
+}
+
+//how many frames have been run so far
+Uint32 frame_number=0;
+
+//logging
+//QLOG(level, category) << "message"; -- queues a line for the log thread to write to stderr, so the game thread (or the audio thread) never waits on a slow console
+//anything above QUIG_LOG_MAX is compiled out completely, anything above the category's runtime level (see --log) is skipped before the message is even built
+enum LogLevel {
+	LOG_FATAL=0, LOG_ERROR, LOG_WARNING, LOG_NOTICE, LOG_DEBUG, LOG_LEVELS
+};
+enum LogCategory {
+	LOG_CORE=0, LOG_VIDEO, LOG_AUDIO, LOG_INPUT, LOG_LUA, LOG_CATEGORIES
+};
+//release builds leave out debug messages entirely
+#ifndef QUIG_LOG_MAX
+#ifdef NDEBUG
+#define QUIG_LOG_MAX LOG_NOTICE
+#else
+#define QUIG_LOG_MAX LOG_DEBUG
+#endif
+#endif
+const char *log_level_names[LOG_LEVELS]={"fatal", "error", "warning", "notice", "debug"};
+const char *log_level_prefixes[LOG_LEVELS]={"fatal error", "error", "warning", "notice", "debug"};
+const char *log_category_names[LOG_CATEGORIES]={"core", "video", "audio", "input", "lua"};
+int log_levels[LOG_CATEGORIES]={LOG_NOTICE, LOG_NOTICE, LOG_NOTICE, LOG_NOTICE, LOG_NOTICE};
+
+//one line of the log
+struct LogRecord {
+	static const int TEXT_MAX=240; //longer messages get cut off
+	Uint8 level;
+	Uint8 category;
+	Uint32 frame;
+	char text[TEXT_MAX];
+};
+
+//LogRing -- fixed-size queue that any number of threads can push to, with one thread popping
+//each slot has a sequence number saying whose turn it is, so a producer only has to win a compare-and-swap on the head to claim a slot
+//holds up to N items, N has to be a power of 2
+template<typename T, int N>
+struct LogRing {
+	struct Slot {
+		SDL_atomic_t sequence;
+		T item;
+	};
+	Slot slots[N];
+	SDL_atomic_t head; //next slot to claim, producers race for this
+	int tail=0; //next slot to read, only the consumer touches this (so producers can't look at it either)
+	LogRing() {
+		for (int ii=0; ii<N; ii++) {
+			SDL_AtomicSet(&slots[ii].sequence, ii);
 		}
+		SDL_AtomicSet(&head, 0);
 	}
-	//play a sample on a given channel
-	void play(int channel) {
-		Mix_PlayChannel(channel, snd, 0);
+	//add an item, returns false if the queue is full
+	bool push(const T &item) {
+		int pos=SDL_AtomicGet(&head);
+		while (true) {
+			Slot &slot=slots[pos & (N-1)];
+			int diff=SDL_AtomicGet(&slot.sequence)-pos;
+			if (diff==0) {
+				//the slot is free, try to claim it
+				if (SDL_AtomicCAS(&head, pos, pos+1)) {
+					slot.item=item;
+					SDL_AtomicSet(&slot.sequence, pos+1);
+					return true;
+				}
+				pos=SDL_AtomicGet(&head);
+			}
+			else if (diff < 0) {
+				//the consumer hasn't gotten to this slot yet
+				return false;
+			}
+			else {
+				//someone else claimed it first
+				pos=SDL_AtomicGet(&head);
+			}
+		}
 	}
-	//play looping
-	void playloop(int channel) {
-		Mix_PlayChannel(channel, snd, -1);
+	//remove the oldest item, returns false if there wasn't one (or it's still being written)
+	bool pop(T &item) {
+		Slot &slot=slots[tail & (N-1)];
+		if (SDL_AtomicGet(&slot.sequence) != tail+1) {
+			return false;
+		}
+		item=slot.item;
+		SDL_AtomicSet(&slot.sequence, tail+N);
+		tail++;
+		return true;
 	}
 };
-quig_Sound samples[AUDIO_MAX];
-#endif
-*/
-/*
-//TODO: log errors
-void initAudio() {
-	sound_enabled=false;
-	#ifndef QUIG_NOSOUND
-	std::cerr << "notice: initializing audio...\n";
-	if (SDL_InitSubSystem(SDL_INIT_AUDIO)) {
-		std::cerr << "error: couldn't initialize SDL audio!\n";
+LogRing<LogRecord, 256> log_ring;
+SDL_atomic_t log_dropped; //lines lost because the ring was full
+SDL_atomic_t log_running;
+SDL_sem *log_wake=NULL;
+SDL_sem *log_drained=NULL; //posted once for each thread in log_flush_waiters, after the log thread has written everything they pushed
+SDL_atomic_t log_flush_waiters;
+SDL_Thread *log_thread=NULL;
+
+//write a line to stderr right away
+void writeLog(const LogRecord &record) {
+	std::cerr << log_level_prefixes[record.level] << ": [" << log_category_names[record.category] << "] " << record.text << "\n";
+}
+
+//write out everything that's waiting
+void drainLog() {
+	LogRecord record;
+	while (log_ring.pop(record)) {
+		writeLog(record);
+	}
+	int dropped=SDL_AtomicSet(&log_dropped, 0);
+	if (dropped) {
+		std::cerr << "warning: [core] " << dropped << " log lines were dropped, the log couldn't keep up\n";
+	}
+}
+
+//drain the log, then let anyone waiting on it know
+//the waiters are counted before draining, so everything they pushed beforehand is out by the time they're told
+void flushLog() {
+	int waiting=SDL_AtomicSet(&log_flush_waiters, 0);
+	drainLog();
+	for (; waiting>0; waiting--) {
+		SDL_SemPost(log_drained);
+	}
+}
+
+//log thread, just writes lines out as they come in
+int logThread(void *data) {
+	while (SDL_AtomicGet(&log_running)) {
+		SDL_SemWaitTimeout(log_wake, 100);
+		flushLog();
+	}
+	flushLog();
+	return 0;
+}
+
+//send a line to the log thread
+//before the thread starts (or if it couldn't), and for fatal errors, the line gets written immediately instead
+void pushLog(int level, int category, const std::string &text) {
+	LogRecord record;
+	record.level=level;
+	record.category=category;
+	record.frame=frame_number;
+	size_t len=text.size();
+	if (len > LogRecord::TEXT_MAX-1) {
+		len=LogRecord::TEXT_MAX-1;
+	}
+	memcpy(record.text, text.data(), len);
+	record.text[len]=0;
+	if (!SDL_AtomicGet(&log_running)) {
+		writeLog(record);
+		return;
+	}
+	if (level==LOG_FATAL) {
+		//quig is probably about to exit, so wait for the log thread to write this (and everything before it) out
+		//only the log thread writes while it's running, so nothing gets mixed together
+		bool pushed=log_ring.push(record);
+		SDL_AtomicIncRef(&log_flush_waiters);
+		SDL_SemPost(log_wake);
+		SDL_SemWaitTimeout(log_drained, 1000);
+		//the ring was full, but it's been emptied now
+		if (!pushed) {
+			writeLog(record);
+		}
 		return;
 	}
-	int flags=MIX_INIT_MP3;
-	if (!(Mix_Init(flags) & flags)) {
-		std::cerr << "error: couldn't initialize MP3 support, music will not work!\n";
+	if (!log_ring.push(record)) {
+		SDL_AtomicIncRef(&log_dropped);
+	}
+	SDL_SemPost(log_wake);
+}
+
+//builds up a line with << and sends it off when it goes out of scope
+struct LogLine {
+	int level;
+	int category;
+	std::ostringstream out;
+	LogLine(int new_level, int new_category) {
+		level=new_level;
+		category=new_category;
+	}
+	~LogLine() {
+		pushLog(level, category, out.str());
 	}
-	if (Mix_OpenAudio(sound_freq, MIX_DEFAULT_FORMAT, 2, buffer_len)) {
-		std::cerr << "error: couldn't open audio device, sound will not work!" << "frequency: " << sound_freq << ", buffer: " << buffer_len << "!\n";
+	std::ostream& stream() {
+		return out;
+	}
+};
+#define QLOG(level, category) \
+	if ((level) > QUIG_LOG_MAX || (level) > log_levels[category]) {} \
+	else LogLine(level, category).stream()
+
+//start up the log thread
+void startLog() {
+	log_wake=SDL_CreateSemaphore(0);
+	log_drained=SDL_CreateSemaphore(0);
+	if (!log_wake || !log_drained) {
 		return;
 	}
-	if (QUIG_DEBUG) {
-		std::cerr << "debug: sound is activated\n";
+	SDL_AtomicSet(&log_running, 1);
+	log_thread=SDL_CreateThread(logThread, "quig log", NULL);
+	if (!log_thread) {
+		SDL_AtomicSet(&log_running, 0);
 	}
-	sound_enabled=true;
-	//load music files
-	for (int ii=0; ii<AUDIO_MAX; ii++) {
-		std::stringstream songname;
-		songname << base_name << ".song" << ii << ".mp3";
-		std::string songstr=songname.str();
-		if (QUIG_DEBUG) {
-			std::cerr << "debug: [music] looking for '" << songstr << "'\n";
+}
+
+//write out anything left and stop the log thread, anything logged after this is written immediately
+void stopLog() {
+	if (!log_thread) {
+		return;
+	}
+	SDL_AtomicSet(&log_running, 0);
+	SDL_SemPost(log_wake);
+	SDL_WaitThread(log_thread, NULL);
+	log_thread=NULL;
+}
+
+//set the log levels from a --log argument: "level" for every category, or "category=level" for just one
+//returns false if it doesn't make sense
+bool setLogLevel(const std::string &arg) {
+	std::string category="";
+	std::string level=arg;
+	size_t split=arg.find('=');
+	if (split != std::string::npos) {
+		category=arg.substr(0, split);
+		level=arg.substr(split+1);
+	}
+	int level_num=-1;
+	for (int ii=0; ii<LOG_LEVELS; ii++) {
+		if (level==log_level_names[ii]) {
+			level_num=ii;
 		}
-		songs[ii].load(songstr.c_str());
-		if (songs[ii].loaded) {
-			std::cerr << "notice: loaded song file '" << songstr << "!'\n";
+	}
+	if (level_num < 0) {
+		return false;
+	}
+	for (int ii=0; ii<LOG_CATEGORIES; ii++) {
+		if (category=="" || category==log_category_names[ii]) {
+			log_levels[ii]=level_num;
+			if (category != "") {
+				return true;
+			}
 		}
 	}
-	//load samples
-	for (int ii=0; ii<AUDIO_MAX; ii++) {
-		std::stringstream soundname_wav;
-		//generate filename
-		soundname_wav << base_name << ".snd" << ii << ".wav";
-		std::string soundstr_wav=soundname_wav.str();
-		//load file
-		if (QUIG_DEBUG) {
-			std::cerr << "debug: [samples] looking for '" << soundstr_wav << "'...\n";
+	return category=="";
+}
+
+//tracing
+//--trace file.json records how long each part of startup and of every frame took, as Chrome trace events (open it with Perfetto, ui.perfetto.dev, or chrome://tracing)
+//each thread keeps its own list of events in memory, and they're only written out when quig exits, so tracing doesn't hold anything up while it runs
+//when it's off, a TRACE_SCOPE costs a single atomic read of trace_enabled
+//the audio thread's buffer is made up front at full size, so the audio callback never allocates
+const size_t TRACE_MAX_EVENTS=1<<20; //per thread, about 24MB worth
+struct TraceEvent {
+	const char *name; //always a string literal
+	Uint64 start;
+	Uint64 end;
+};
+struct TraceBuffer {
+	std::string thread_name;
+	int tid;
+	std::vector<TraceEvent> events;
+	Uint32 dropped=0;
+};
+SDL_atomic_t trace_enabled; //read from every thread that traces, so it has to be atomic
+std::string trace_name=""; //--trace file
+Uint64 trace_base=0; //when the trace starts, in performance counter ticks
+SDL_mutex *trace_lock=NULL; //only needed for adding a new thread's buffer
+std::vector<TraceBuffer*> trace_buffers;
+thread_local TraceBuffer *trace_local=NULL;
+TraceBuffer *trace_audio=NULL; //the audio callback's buffer, see audioCallback()
+
+//is tracing on?
+inline bool tracing() {
+	return SDL_AtomicGet(&trace_enabled) != 0;
+}
+
+//make a new buffer with room for reserve events
+TraceBuffer* newTraceBuffer(size_t reserve) {
+	TraceBuffer *buffer=new TraceBuffer;
+	buffer->events.reserve(reserve);
+	SDL_LockMutex(trace_lock);
+	buffer->tid=(int)trace_buffers.size()+1;
+	std::ostringstream name;
+	name << "thread " << buffer->tid;
+	buffer->thread_name=name.str();
+	trace_buffers.push_back(buffer);
+	SDL_UnlockMutex(trace_lock);
+	return buffer;
+}
+
+//the current thread's buffer, made the first time it traces anything
+TraceBuffer* traceBuffer() {
+	if (!trace_local) {
+		trace_local=newTraceBuffer(4096);
+	}
+	return trace_local;
+}
+
+//record something that happened on this thread between two performance counter readings
+void traceEvent(const char *name, Uint64 start, Uint64 end) {
+	TraceBuffer *buffer=traceBuffer();
+	if (buffer->events.size() >= TRACE_MAX_EVENTS) {
+		buffer->dropped++;
+		return;
+	}
+	TraceEvent event={name, start, end};
+	buffer->events.push_back(event);
+}
+
+//give the current thread a name in the trace
+void traceThread(const char *name) {
+	if (tracing()) {
+		traceBuffer()->thread_name=name;
+	}
+}
+
+//times from when it's made to when it goes out of scope
+struct TraceScope {
+	const char *name;
+	Uint64 start;
+	TraceScope(const char *new_name) {
+		name=new_name;
+		start=tracing() ? SDL_GetPerformanceCounter() : 0;
+	}
+	~TraceScope() {
+		if (start) {
+			traceEvent(name, start, SDL_GetPerformanceCounter());
 		}
-		samples[ii].load(soundstr_wav.c_str());
-		if (samples[ii].loaded) {
-			std::cerr << "notice: loaded sound file '" << soundstr_wav << "!'\n";
+	}
+};
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_JOIN(trace_scope_, __LINE__)(name)
+
+//start tracing, with times counted from base, returns false if it can't
+bool startTrace(Uint64 base) {
+	trace_lock=SDL_CreateMutex();
+	if (!trace_lock) {
+		return false;
+	}
+	trace_base=base;
+	trace_audio=newTraceBuffer(TRACE_MAX_EVENTS);
+	trace_audio->thread_name="quig audio";
+	SDL_AtomicSet(&trace_enabled, 1);
+	traceThread("quig main");
+	return true;
+}
+
+//write out everything that was traced, once every other thread that traces has stopped
+void finishTrace() {
+	if (!tracing()) {
+		return;
+	}
+	SDL_AtomicSet(&trace_enabled, 0);
+	std::ofstream outfile(trace_name.c_str());
+	double freq=SDL_GetPerformanceFrequency()/1000000.0;
+	size_t count=0;
+	Uint32 dropped=0;
+	outfile << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	for (size_t tt=0; tt<trace_buffers.size(); tt++) {
+		TraceBuffer *buffer=trace_buffers[tt];
+		outfile << (tt ? ",\n" : "") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid << ",\"args\":{\"name\":\"" << buffer->thread_name << "\"}}";
+		for (size_t ii=0; ii<buffer->events.size(); ii++) {
+			const TraceEvent &event=buffer->events[ii];
+			outfile << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+				<< ",\"ts\":" << (double)(Sint64)(event.start-trace_base)/freq << ",\"dur\":" << (event.end-event.start)/freq << "}";
 		}
+		count+=buffer->events.size();
+		dropped+=buffer->dropped;
+		delete buffer;
 	}
-	#endif
+	trace_buffers.clear();
+	outfile << "\n]}\n";
+	if (!outfile) {
+		QLOG(LOG_ERROR, LOG_CORE) << "could not write trace '" << trace_name << "'!";
+	}
+	else {
+		QLOG(LOG_NOTICE, LOG_CORE) << "wrote " << count << " trace events to '" << trace_name << "'";
+	}
+	if (dropped) {
+		QLOG(LOG_WARNING, LOG_CORE) << dropped << " trace events didn't fit and were dropped";
+	}
+	SDL_DestroyMutex(trace_lock);
+	trace_lock=NULL;
 }
-*/
 
+//sound stuff
+const int NUM_CHANNELS = 8; //sample channels
+const int SOUND_MAX = 32; //sound files, game.snd0.wav to game.snd31.wav
+const int SOUND_MAX_VOLUME = 15;
+bool sound_enabled=true; //is audio allowed?
+bool sound_active = false; //has sound been initialized?
+bool offline_audio = false; //are we rendering audio to a file a frame at a time instead of playing it?
+bool sound_muted = false; //set while the game runs a frame that's just for show (see Rewind), so it doesn't make any noise
+int sound_freq=48000;
+int buffer_len=1024;
+const int samples_frame = 800; //how many samples are in a typical frame
+SDL_AudioDeviceID audio_id=0;
+
+//filename of game
+std::string arg_name;
+//the above, without the extension
+std::string base_name;
+//the sprite sheet's filename
+std::string gfx_name;
+
+//a file mapped into memory, read-only as far as the file is concerned (writes just make a private copy of the page)
+struct MappedFile {
+	Uint8 *data=NULL;
+	size_t size=0;
+	#ifdef _WIN32
+	HANDLE file=INVALID_HANDLE_VALUE;
+	HANDLE mapping=NULL;
+	#endif
+	//map a whole file, returns false if it can't
+	bool open(const std::string &name) {
+		close();
+		#ifdef _WIN32
+		file=CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file==INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart==0) {
+			close();
+			return false;
+		}
+		size=(size_t)file_size.QuadPart;
+		mapping=CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (mapping) {
+			data=(Uint8*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		}
+		#else
+		int fd=::open(name.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if (!fstat(fd, &info) && info.st_size > 0) {
+			size=(size_t)info.st_size;
+			void *mapped=mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (mapped != MAP_FAILED) {
+				data=(Uint8*)mapped;
+			}
+		}
+		::close(fd);
+		#endif
+		if (!data) {
+			close();
+			return false;
+		}
+		return true;
+	}
+	void close() {
+		#ifdef _WIN32
+		if (data) {
+			UnmapViewOfFile(data);
+		}
+		if (mapping) {
+			CloseHandle(mapping);
+			mapping=NULL;
+		}
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+			file=INVALID_HANDLE_VALUE;
+		}
+		#else
+		if (data) {
+			munmap(data, size);
+		}
+		#endif
+		data=NULL;
+		size=0;
+	}
+};
+
+//the game's .quigpak, if it was started from one (see quigpak.h)
+struct QuigPak {
+	MappedFile file;
+	std::vector<PakEntry> entries;
+	bool open(const std::string &name) {
+		if (!file.open(name)) {
+			return false;
+		}
+		if (!readPakIndex(file.data, file.size, entries)) {
+			file.close();
+			return false;
+		}
+		return true;
+	}
+	bool active() {
+		return file.data != NULL;
+	}
+	//look up an entry by name, NULL if it isn't there
+	const PakEntry* find(const std::string &name) {
+		for (size_t ii=0; ii<entries.size(); ii++) {
+			if (entries[ii].name==name) {
+				return &entries[ii];
+			}
+		}
+		return NULL;
+	}
+	const Uint8* data(const PakEntry *entry) {
+		return file.data+entry->offset;
+	}
+};
+QuigPak game_pak;
+
+//open one of the game's files, eg, openAsset("snd0.wav") for my-game.snd0.wav
+//from the package when there is one, straight from the disk otherwise, returns NULL if it isn't there
+SDL_RWops* openAsset(const std::string &name) {
+	if (game_pak.active()) {
+		const PakEntry *entry=game_pak.find(name);
+		return entry ? SDL_RWFromConstMem(game_pak.data(entry), entry->size) : NULL;
+	}
+	return SDL_RWFromFile((base_name+"."+name).c_str(), "rb");
+}
 //these were constants, now they aren't
 //these get resized, but just in case something goes wrong, we initialize them to 1x scale
 int window_scale=1;
@@ -222,680 +721,4612 @@ int window_height=VIEW_HEIGHT;
 //this doesn't do anything after the window has been created
 //TODO: probably should allow non-integer scales
 void setWindowScale(int s) {
-	if (QUIG_DEBUG) {
-		std::cerr << "debug: setting window scale to " << s << "\n";
-	}
+	QLOG(LOG_DEBUG, LOG_VIDEO) << "setting window scale to " << s;
 	window_scale=s;
 	window_width=(VIEW_WIDTH*window_scale);
 	window_height=(VIEW_HEIGHT*window_scale);
 }
 
-void generateTone(int n) {
-	for (int ii = 0; ii < samples_frame + samples_frame_offset; ii++) {
-		if (n <= 1) {
-			audio_buffer[ii] = 0;
+//the synthesizer
+//a handful of chip-style voices (pulse waves with a selectable duty cycle, a stepped triangle, and LFSR noise) rendered through Blip_Buffer
+//every waveform here is a series of flat steps, so instead of working out every sample, we only tell Blip_Synth about each step (offset()) and it builds the band-limited result
+//that keeps the cost down to a few dozen calls per voice per frame, regardless of the output rate
+const int SYNTH_VOICES=8;
+const int SYNTH_CLOCKS_SAMPLE=64; //synth clocks per output sample, finer clocks mean more accurate pitches
+const int SYNTH_MAX_VOLUME=15;
+const int WAVE_TRIANGLE=8; //waves 1-7 are pulse waves with a duty cycle of n/8, 4 is a square wave
+const int WAVE_NOISE=9;
+Blip_Buffer synth_buffer;
+Blip_Synth<blip_good_quality, SYNTH_MAX_VOLUME*2> synth;
+
+//the stepped triangle (like the NES has), one period is 32 steps
+const int triangle_steps[32]={
+	15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0,
+	0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15
+};
+
+struct SynthVoice {
+	int wave=0; //0 is off, see above
+	long period=0; //clocks per full cycle, or per step for noise
+	int volume=0; //0-15
+	int length=0; //frames left to play, 0 plays until stopped
+	int decay=0; //frames per step of volume lost, 0 holds the volume
+	int decay_count=0;
+	bool short_noise=false; //shorter LFSR loop, more of a metallic buzz than a hiss
+	//playback state
+	blip_time_t next=0; //clock (within the current frame) of the next step
+	int phase=0;
+	int amp=0; //what we've told Blip_Synth this voice is outputting
+	Uint16 lfsr=1;
+
+	//how many steps make up one period
+	int steps() {
+		if (wave==WAVE_TRIANGLE) { return 32; }
+		if (wave==WAVE_NOISE) { return 1; }
+		return 8;
+	}
+	//length of the current step -- worked out from the whole period so rounding doesn't throw off the pitch
+	long stepLength() {
+		int n=steps();
+		long len=period*(phase+1)/n - period*phase/n;
+		return (len > 0) ? len : 1;
+	}
+	//output level for the current step
+	int level() {
+		if (wave==0 || volume==0) {
+			return 0;
+		}
+		if (wave==WAVE_NOISE) {
+			return (lfsr & 1) ? volume : -volume;
 		}
-		else if (ii % n < 10) {
-			audio_buffer[ii] = 3000;
+		if (wave==WAVE_TRIANGLE) {
+			return (triangle_steps[phase]*2-15) * volume / 15;
+		}
+		return (phase < wave) ? volume : -volume;
+	}
+	//move on to the next step
+	void advance() {
+		if (wave==WAVE_NOISE) {
+			int tap=short_noise ? 6 : 1;
+			int bit=(lfsr ^ (lfsr >> tap)) & 1;
+			lfsr=(lfsr >> 1) | (bit << 14);
 		}
 		else {
-			audio_buffer[ii] = -3000;
+			phase=(phase+1) % steps();
+		}
+	}
+	//emit every step that falls within this frame
+	void run(blip_time_t frame_clocks) {
+		//volume (or the wave itself) may have changed since last frame, that takes effect right away
+		int new_amp=level();
+		if (new_amp != amp) {
+			synth.offset(0, new_amp-amp, &synth_buffer);
+			amp=new_amp;
+		}
+		if (wave==0) {
+			next=0;
+			return;
+		}
+		while (next < frame_clocks) {
+			advance();
+			new_amp=level();
+			if (new_amp != amp) {
+				synth.offset(next, new_amp-amp, &synth_buffer);
+				amp=new_amp;
+			}
+			next+=stepLength();
+		}
+		next-=frame_clocks;
+	}
+	//length counter and volume envelope, once a frame
+	void tick() {
+		if (wave==0) {
+			return;
+		}
+		if (length > 0) {
+			length--;
+			if (length==0) {
+				wave=0;
+				return;
+			}
+		}
+		if (decay > 0 && volume > 0) {
+			decay_count++;
+			if (decay_count >= decay) {
+				decay_count=0;
+				volume--;
+			}
+		}
+	}
+	//start a new sound on this voice
+	void start(int new_wave, double freq, int new_volume, int new_length, int new_decay) {
+		long rate=synth_buffer.sample_rate();
+		//frequencies past what we can output just alias into junk
+		if (freq < 1 || freq > rate/2 || new_wave < 1 || new_wave > WAVE_NOISE) {
+			wave=0;
+			return;
+		}
+		//the phase keeps going when a voice is retriggered, so there's no click
+		wave=new_wave;
+		phase%=steps();
+		period=(long)(rate*SYNTH_CLOCKS_SAMPLE / freq);
+		if (period < 1) {
+			period=1;
+		}
+		volume=max2(0, min2(new_volume, SYNTH_MAX_VOLUME));
+		length=max2(new_length, 0);
+		decay=max2(new_decay, 0);
+		decay_count=0;
+		//don't leave a new, faster sound waiting on the last step of a slow one
+		if (next > stepLength()) {
+			next=0;
+		}
+	}
+};
+SynthVoice synth_voices[SYNTH_VOICES];
+
+//samples
+//every sound file gets converted to the device's format once, at load time, and stored one after another in a single pool
+//so playing them back is nothing but adding numbers together
+struct SoundInfo {
+	size_t start=0; //where it starts in sound_pool
+	size_t length=0; //0 if it wasn't loaded
+};
+std::vector<Sint16> sound_pool;
+SoundInfo sounds[SOUND_MAX];
+//a channel playing a sample, only touched by the audio thread
+struct SampleChannel {
+	int sound=-1; //-1 if the channel isn't playing anything
+	size_t pos=0;
+	bool loop=false;
+	Sint16 gain=0; //volume, as a fraction of 32768
+	//start playing a sound
+	void play(int new_sound, int volume, bool new_loop) {
+		sound=new_sound;
+		pos=0;
+		loop=new_loop;
+		volume=max2(0, min2(volume, SOUND_MAX_VOLUME));
+		gain=(Sint16)(volume*32767/SOUND_MAX_VOLUME);
+	}
+};
+SampleChannel channels[NUM_CHANNELS];
+
+//out[ii]+=in[ii]*gain, saturating at the limits instead of wrapping around
+void mixSamples(Sint16 *out, const Sint16 *in, int count, Sint16 gain) {
+	int ii=0;
+	#if defined(QUIG_SSE2)
+	//SSE2 doesn't have a rounding 16-bit fractional multiply, so do it in 32 bits and pack back down
+	__m128i gain_v=_mm_set1_epi16(gain);
+	for (; ii+8 <= count; ii+=8) {
+		__m128i src=_mm_loadu_si128((const __m128i*)(in+ii));
+		__m128i lo=_mm_mullo_epi16(src, gain_v);
+		__m128i hi=_mm_mulhi_epi16(src, gain_v);
+		__m128i scaled=_mm_packs_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15), _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15));
+		__m128i dst=_mm_loadu_si128((const __m128i*)(out+ii));
+		_mm_storeu_si128((__m128i*)(out+ii), _mm_adds_epi16(dst, scaled));
+	}
+	#elif defined(QUIG_NEON)
+	int16x8_t gain_v=vdupq_n_s16(gain);
+	for (; ii+8 <= count; ii+=8) {
+		int16x8_t scaled=vqdmulhq_s16(vld1q_s16(in+ii), gain_v);
+		vst1q_s16(out+ii, vqaddq_s16(vld1q_s16(out+ii), scaled));
+	}
+	#endif
+	//whatever's left over (or everything, without SIMD)
+	for (; ii < count; ii++) {
+		int mixed=out[ii]+((in[ii]*gain)>>15);
+		out[ii]=(Sint16)max2(-32768, min2(mixed, 32767));
+	}
+}
+
+//mix whatever a channel is playing into the output
+void runChannel(SampleChannel &ch, Sint16 *out, int count) {
+	while (ch.sound >= 0 && count > 0) {
+		const SoundInfo &info=sounds[ch.sound];
+		size_t left=info.length-ch.pos;
+		int chunk=left < (size_t)count ? (int)left : count;
+		mixSamples(out, &sound_pool[info.start+ch.pos], chunk, ch.gain);
+		out+=chunk;
+		count-=chunk;
+		ch.pos+=chunk;
+		if (ch.pos >= info.length) {
+			ch.pos=0;
+			if (!ch.loop) {
+				ch.sound=-1;
+			}
 		}
 	}
 }
 
-//show the arguments you can use
-void showHelp() {
-	std::cout
-		<< "\nusage:\n"
-		<< "  quig [arguments] gamefile\n"
-		<< "\narguments:\n"
-		<< "  -?, --help: show this help message here\n"
-		<< "  --soft: use software scaling for display (no vsync)\n"
-		<< "  --hard: use hardware scaling for display (no vsync) (default)\n"
-		<< "  --hard-vsync: use hardware scaling for display (vsync, display must run at 60hz)\n"
-		<< "  --fullscreen: run quig in fullscreen\n"
-		<< "  --window: run quig in a window (default)\n"
-		<< "  --auto-scale: automatically size the quig window (default)\n"
-		<< "  --scale n: scale the quig window by a given amount (eg, --scale 2)\n"
-		;
+//load a sound file into the pool, converting it to the device's format
+//returns !=0 on failure
+int loadSound(int num, const char *filename, int rate) {
+	SDL_AudioSpec spec;
+	Uint8 *data=NULL;
+	Uint32 len=0;
+	SDL_RWops *src=openAsset(filename);
+	if (!src || !SDL_LoadWAV_RW(src, 1, &spec, &data, &len)) {
+		return 1;
+	}
+	SDL_AudioCVT cvt;
+	if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, AUDIO_S16SYS, 1, rate) < 0) {
+		QLOG(LOG_ERROR, LOG_AUDIO) << "can't convert sound file '" << filename << "': " << SDL_GetError();
+		SDL_FreeWAV(data);
+		return 1;
+	}
+	std::vector<Uint8> buf(len*cvt.len_mult);
+	memcpy(buf.data(), data, len);
+	SDL_FreeWAV(data);
+	cvt.buf=buf.data();
+	cvt.len=len;
+	if (SDL_ConvertAudio(&cvt)) {
+		QLOG(LOG_ERROR, LOG_AUDIO) << "can't convert sound file '" << filename << "': " << SDL_GetError();
+		return 1;
+	}
+	size_t count=cvt.len_cvt/2;
+	sounds[num].start=sound_pool.size();
+	sounds[num].length=count;
+	sound_pool.insert(sound_pool.end(), (Sint16*)buf.data(), (Sint16*)buf.data()+count);
+	return 0;
 }
 
+//load all of the game's sound files, has to happen before the audio device starts
+void loadSounds() {
+	if (!sound_active) {
+		return;
+	}
+	for (int ii=0; ii<SOUND_MAX; ii++) {
+		std::stringstream soundname;
+		soundname << "snd" << ii << ".wav";
+		std::string soundstr=soundname.str();
+		QLOG(LOG_DEBUG, LOG_AUDIO) << "looking for '" << soundstr << "'...";
+		if (!loadSound(ii, soundstr.c_str(), synth_buffer.sample_rate())) {
+			QLOG(LOG_NOTICE, LOG_AUDIO) << "loaded sound file '" << soundstr << "'!";
+		}
+	}
+}
 
-//quig isn't hardware accelerated (at all, even though it probably could/should be)
-//but we do at least stretch the final screen size in hardware if asked to
-//and doing that is required for vsync
-enum class DisplayMode {
-	soft, hard_novsync, hard_vsync
-};
-DisplayMode display_mode=DisplayMode::hard_novsync; //TODO: make this a compile-time option for what is default?
-bool fullscreen=false; //TODO: fullscreen in software mode ignores aspect ratio, need to fix that
+//audio stats, written by the audio thread and read by getstats() and the F3 overlay
+//(in microseconds and parts per million, since these are ints)
+const int AUDIO_FILL_BUCKETS = 8; //under a frame, then 1, 2, ... 7 or more frames
+SDL_atomic_t audio_fill_us; //how far behind the game the audio is running (filtered)
+SDL_atomic_t audio_latency_us; //how long from the game making a sound to it coming out of the device
+SDL_atomic_t audio_rate_ppm; //how far off from the nominal length the frames are being stretched
+SDL_atomic_t audio_underruns; //frames the mixer got to before the game finished them, so their sounds came in late
+SDL_atomic_t music_underruns; //times the decode thread didn't have the song ready in time
+SDL_atomic_t audio_fill_hist[AUDIO_FILL_BUCKETS]; //how often the fill was in each bucket, once per callback
+SDL_atomic_t mixer_us; //time spent mixing per callback (averaged)
+SDL_atomic_t mixer_max_us; //the longest callback so far
+int audio_device_samples=0; //the size of the device's buffer, which adds to latency
 
-//parse the arugment list
-int handleArgs(int argc, char **argv) {
-	int size=-1; //automatically set the screen scale based on screen width and screen height (minus 64)
-	int user_size = -1; //how much the user wants the scale
-	std::string current="";
-	for (int ii=0; ii<argc; ii++) {
-		current=argv[ii];
-		if (QUIG_DEBUG) {
-			std::cerr << "debug: arg #" << ii << ": '" << current << "'\n";
+//music
+//songs aren't loaded up front, they're streamed: a background thread reads and decodes the file a bit at a time, converts it to the device's format,
+//and hands it to the mixer in fixed-size chunks, so a song only ever has a second or so of itself in memory no matter how long it is
+//looping songs can have a loop point, so an intro plays once and the rest repeats -- for WAV files that's the first loop in the 'smpl' chunk,
+//for Ogg Vorbis files that's the LOOPSTART and LOOPLENGTH (or LOOPEND) comments, in samples
+//the decoder just seeks back to the loop start and keeps converting, so the seam is as smooth as the song itself
+const int SONG_MAX = 32; //song files, game.song0.wav (or .ogg) to game.song31.wav
+const int MUSIC_CHUNK = 1024; //samples
+const int MUSIC_CHUNKS = 64; //how many chunks the decoder can get ahead of the mixer, 64 is a bit over a second
+enum {
+	MUSIC_WAV, MUSIC_VORBIS
+};
+//an open song file, only touched by the decode thread
+struct MusicStream {
+	int type=MUSIC_WAV;
+	SDL_RWops *file=NULL; //for WAV files, and underneath Ogg Vorbis files
+	long data_start=0; //where the samples start in the file
+	int frame_bytes=0; //size of one sample, times the number of channels
+	#ifdef QUIG_VORBIS
+	OggVorbis_File vorbis;
+	#endif
+	bool open=false;
+	SDL_AudioStream *convert=NULL;
+	long length=0; //in sample frames
+	long pos=0;
+	long loop_start=0;
+	long loop_end=0; //where to jump back to loop_start, the end of the file if the song doesn't say
+	bool loop=false;
+	bool done=true;
+	bool seeked=false; //just went back to loop_start, so if nothing comes after that, the song's over instead of looping forever
+	//read part of the song in its own format, up to the end (or the loop end), returns how many bytes were read
+	long readRaw(Uint8 *buf, long bytes) {
+		long end=loop ? loop_end : length;
+		long frames=min2((int)(bytes/frame_bytes), (int)(end-pos));
+		if (frames <= 0) {
+			return 0;
 		}
-		//empty argument
-		if (current.size()<1) {
-			continue;
+		#ifdef QUIG_VORBIS
+		if (type==MUSIC_VORBIS) {
+			int section;
+			long got=ov_read(&vorbis, (char*)buf, frames*frame_bytes, 0, 2, 1, &section);
+			if (got <= 0) {
+				return 0;
+			}
+			pos+=got/frame_bytes;
+			return got;
 		}
-		//handle arguments
-		//quig allows the same argument to be repeated (eg, if you have a script that has default settings, but allows them to be changed), the most recent argument is the one that is used
-		//nothing stops you from running quig like
-		//  $ quig default.quig --scale 4 --hard-vsync ~/mygame.quig --auto-scale --hard
-		//where it'll end up using automatic scale, no v-sync, and run ~/mygame.quig instead of default.quig
-		if (current[0]=='-') {
-			//software mode, no v-sync
-			if (current=="--soft") {
-				display_mode=DisplayMode::soft;
-			}
-			//hardware mode, no v-sync
-			else if (current=="--hard") {
-				display_mode=DisplayMode::hard_novsync;
+		#endif
+		long got=(long)SDL_RWread(file, buf, frame_bytes, frames);
+		pos+=got;
+		return got*frame_bytes;
+	}
+	//jump to a sample frame, returns !=0 on failure
+	int seek(long frame) {
+		pos=frame;
+		#ifdef QUIG_VORBIS
+		if (type==MUSIC_VORBIS) {
+			return ov_pcm_seek(&vorbis, frame);
+		}
+		#endif
+		return SDL_RWseek(file, data_start+frame*frame_bytes, RW_SEEK_SET) < 0;
+	}
+	//get a chunk's worth of converted samples, returns how many there were (less than a full chunk only at the end of the song)
+	int read(Sint16 *out, int samples) {
+		Uint8 raw[4096];
+		int got=0;
+		while (got < samples) {
+			int avail=SDL_AudioStreamGet(convert, out+got, (samples-got)*2);
+			if (avail < 0) {
+				done=true;
+				return got;
 			}
-			//hardware mode, v-sync
-			else if (current=="--hard-vsync") {
-				display_mode=DisplayMode::hard_vsync;
+			got+=avail/2;
+			if (got >= samples || done) {
+				break;
 			}
-			//fullscreen
-			else if (current=="--fullscreen") {
-				fullscreen=true;
+			long bytes=readRaw(raw, sizeof(raw));
+			if (bytes > 0) {
+				SDL_AudioStreamPut(convert, raw, bytes);
+				seeked=false;
 			}
-			//windowed
-			else if (current=="--window") {
-				fullscreen=false;
+			else if (loop && !seeked && loop_end > loop_start && !seek(loop_start)) {
+				//go around, the converter doesn't know anything happened so there's no gap
+				seeked=true;
 			}
-			//automatic scale (a quig window that comfortably fits on screen)
-			else if (current=="--auto-scale") {
-				user_size=-1;
+			else {
+				//let the converter finish off what it has, then we're out
+				SDL_AudioStreamFlush(convert);
+				done=true;
 			}
-			//user-defined scale
-			else if (current=="--scale") {
-				//attempt to get next arg
-				//bail if we run out of arguments
-				if (ii+1 >=argc) {
-					std::cerr << "fatal error: no scale factor given!\n";
-					return 1;
+		}
+		return got;
+	}
+	//open a WAV file, returns !=0 if it can't be played
+	int openWav(const char *filename, int rate) {
+		file=openAsset(filename);
+		if (!file) {
+			return 1;
+		}
+		type=MUSIC_WAV;
+		open=true;
+		Uint8 header[12];
+		if (SDL_RWread(file, header, 1, 12) != 12 || memcmp(header, "RIFF", 4) || memcmp(header+8, "WAVE", 4)) {
+			QLOG(LOG_ERROR, LOG_AUDIO) << "'" << filename << "' isn't a WAV file!";
+			return 1;
+		}
+		SDL_AudioFormat format=0;
+		int channels=0, freq=0;
+		long data_bytes=-1;
+		//go through the chunks, we want fmt and data, and smpl if it's there
+		Uint8 chunk[8];
+		while (SDL_RWread(file, chunk, 1, 8)==8) {
+			long size=(long)getU32(chunk+4);
+			long next=(long)SDL_RWtell(file)+size+(size&1);
+			if (!memcmp(chunk, "fmt ", 4) && size >= 16) {
+				Uint8 fmt[40]={0};
+				if (SDL_RWread(file, fmt, 1, min2(size, 40)) < 16) {
+					break;
 				}
-				//advance the argument list, grab and convert the next argument
-				ii++;
-				std::string sub_arg=argv[ii];
-				try {
-					user_size=std::stoi(sub_arg);
+				int tag=getU16(fmt);
+				if (tag==0xFFFE && size >= 26) {
+					tag=getU16(fmt+24); //WAVE_FORMAT_EXTENSIBLE, the real format is in the subformat
 				}
-				//std::logic_error is the parent to all of the stoi exceptions
-				catch (std::logic_error) { 
-					std::cerr << "fatal error: could not understand '" << sub_arg << "' as a scale factor!\n";
-					return 1;
+				channels=getU16(fmt+2);
+				freq=(int)getU32(fmt+4);
+				int bits=getU16(fmt+14);
+				if (tag==1 && bits==8) {
+					format=AUDIO_U8;
 				}
-				//bad size -- dunno if this will get adjusted if quig supports non-integer scale factors
-				if (user_size<1) {
-					std::cerr << "fatal error: invalid size '" << user_size << "'!\n";
-					return 1;
+				else if (tag==1 && bits==16) {
+					format=AUDIO_S16LSB;
+				}
+				else if (tag==1 && bits==32) {
+					format=AUDIO_S32LSB;
 				}
+				else if (tag==3 && bits==32) {
+					format=AUDIO_F32LSB;
+				}
+				frame_bytes=channels*bits/8;
 			}
-			//show help (also, immediately stops argument handling)
-			else if (current == "-?" || current == "--help") {
-				showHelp();
-				return 2;
+			else if (!memcmp(chunk, "smpl", 4) && size >= 60) {
+				Uint8 smpl[60];
+				if (SDL_RWread(file, smpl, 1, 60)==60 && getU32(smpl+28) > 0) {
+					loop_start=(long)getU32(smpl+44);
+					loop_end=(long)getU32(smpl+48)+1; //smpl's loop end is the last sample played, not one past it
+				}
 			}
-			//unknown argument
-			else {
-				std::cerr << "fatal error: unknown argument '"<< current << "'!" << std::endl;
-				showHelp();
-				return 1;
+			else if (!memcmp(chunk, "data", 4)) {
+				data_start=(long)SDL_RWtell(file);
+				data_bytes=size;
+				//a cut off file says it has more than it does
+				Sint64 file_size=SDL_RWsize(file);
+				if (file_size >= 0 && data_bytes > file_size-data_start) {
+					data_bytes=(long)max2(file_size-data_start, (Sint64)0);
+				}
+			}
+			if (SDL_RWseek(file, next, RW_SEEK_SET) < 0) {
+				break;
 			}
-			
 		}
-		//anything that isn't an argument is a game name, and we run the last one specified
-		else {
-			arg_name=current;
+		if (!format || channels < 1 || freq < 1 || data_bytes < 0) {
+			QLOG(LOG_ERROR, LOG_AUDIO) << "'" << filename << "' is a kind of WAV file quig can't stream! (try 8 or 16-bit PCM)";
+			return 1;
 		}
+		length=data_bytes/frame_bytes;
+		return openConvert(format, channels, freq, rate) || seek(0);
 	}
-	//limit the display size to 3x in software mode because software scaling rapidly gets slow as the size increases
-	int xscale=1,yscale=1;
-	if (size==-1) {
-		SDL_DisplayMode mode;
-		//get a window size that'll fit entirely on the screen, including things like window borders, taskbars, etc
-		//TODO: look into how things are dealt with when working with multiple monitors, we just get the first display here
-		//really would be nice to know what monitor a window will be on before we put it there
-		if (!SDL_GetCurrentDisplayMode(0, &mode)) {
-			xscale=(mode.w-16)/VIEW_WIDTH;
-			yscale=(mode.h-64)/VIEW_HEIGHT; //yeah, this is a bit high, but a 720px window doesn't actually fit on a 768px display because of title/borders/taskbar
-			if (QUIG_DEBUG) {
-				std::cerr << "debug: screen scale values are " << xscale << "," << yscale << "\n";
-			}
+	#ifdef QUIG_VORBIS
+	//open an Ogg Vorbis file, returns !=0 if it can't be played
+	//libvorbisfile reads through these, so songs can come from a package as easily as a file
+	static size_t vorbisRead(void *ptr, size_t size, size_t count, void *source) {
+		return SDL_RWread((SDL_RWops*)source, ptr, size, count);
+	}
+	static int vorbisSeek(void *source, ogg_int64_t offset, int whence) {
+		int rw_whence=(whence==SEEK_CUR) ? RW_SEEK_CUR : (whence==SEEK_END) ? RW_SEEK_END : RW_SEEK_SET;
+		return SDL_RWseek((SDL_RWops*)source, offset, rw_whence) < 0 ? -1 : 0;
+	}
+	static long vorbisTell(void *source) {
+		return (long)SDL_RWtell((SDL_RWops*)source);
+	}
+	int openVorbis(const char *filename, int rate) {
+		file=openAsset(filename);
+		if (!file) {
+			return 1;
 		}
-		//this shouldn't happen, but maybe quig's being run on something weird?
-		else {
-			std::cerr << "error: could not get display information! Auto-scale will not work." <<std::endl;
+		ov_callbacks callbacks={vorbisRead, vorbisSeek, NULL, vorbisTell};
+		if (ov_open_callbacks(file, &vorbis, NULL, 0, callbacks)) {
+			QLOG(LOG_ERROR, LOG_AUDIO) << "'" << filename << "' isn't an Ogg Vorbis file!";
+			return 1;
 		}
-		//set auto-scale
-		if (user_size==-1) {
-			setWindowScale(min2(xscale,yscale));
+		type=MUSIC_VORBIS;
+		open=true;
+		vorbis_info *info=ov_info(&vorbis, -1);
+		frame_bytes=info->channels*2;
+		length=(long)ov_pcm_total(&vorbis, -1);
+		vorbis_comment *comments=ov_comment(&vorbis, -1);
+		char *start=vorbis_comment_query(comments, "LOOPSTART", 0);
+		char *len=vorbis_comment_query(comments, "LOOPLENGTH", 0);
+		char *end=vorbis_comment_query(comments, "LOOPEND", 0);
+		if (start) {
+			loop_start=atol(start);
+			loop_end=len ? loop_start+atol(len) : (end ? atol(end) : 0);
 		}
-		//set user scale
-		else {
-			setWindowScale(user_size);
+		return openConvert(AUDIO_S16LSB, info->channels, (int)info->rate, rate);
+	}
+	#endif
+	//set up the format converter and sanity check the loop points, returns !=0 on failure
+	int openConvert(SDL_AudioFormat format, int channels, int freq, int rate) {
+		convert=SDL_NewAudioStream(format, channels, freq, AUDIO_S16SYS, 1, rate);
+		if (!convert) {
+			QLOG(LOG_ERROR, LOG_AUDIO) << "can't convert song: " << SDL_GetError();
+			return 1;
 		}
-		//limit the size of software scaling because it's very slow and if you're running quig in software scale mode, you probably aren't (or shouldn't be) driving a high-res screen
-		if (display_mode==DisplayMode::soft && window_scale > 3) {
-			setWindowScale(3);
+		if (loop_end <= 0 || loop_end > length) {
+			loop_end=length;
+		}
+		if (loop_start < 0 || loop_start >= loop_end) {
+			loop_start=0;
 		}
+		done=false;
+		seeked=false;
+		return 0;
 	}
-	return 0;
-}
+	//open a song, trying each kind of file it could be, returns !=0 if it can't be played
+	int load(int song, bool new_loop, int rate) {
+		close();
+		loop=new_loop;
+		std::stringstream songname;
+		songname << "song" << song;
+		std::string name=songname.str();
+		#ifdef QUIG_VORBIS
+		if (!openVorbis((name+".ogg").c_str(), rate)) {
+			return 0;
+		}
+		close();
+		#endif
+		if (!openWav((name+".wav").c_str(), rate)) {
+			return 0;
+		}
+		close();
+		return 1;
+	}
+	void close() {
+		if (convert) {
+			SDL_FreeAudioStream(convert);
+			convert=NULL;
+		}
+		#ifdef QUIG_VORBIS
+		if (open && type==MUSIC_VORBIS) {
+			ov_clear(&vorbis);
+		}
+		#endif
+		if (file) {
+			SDL_RWclose(file);
+			file=NULL;
+		}
+		open=false;
+		done=true;
+		pos=loop_start=loop_end=length=0;
+	}
+};
+//decoded samples on their way to the mixer
+struct MusicChunk {
+	int song_id; //which playsong() call this belongs to
+	int count; //0 marks the end of the song
+	Sint16 samples[MUSIC_CHUNK];
+};
+SpscQueue<MusicChunk, MUSIC_CHUNKS> music_chunks; //decode thread pushes, audio callback pops
+//what the game wants playing, handed to the decode thread
+struct MusicRequest {
+	int song=-1; //-1 to stop
+	bool loop=false;
+	int song_id=0; //goes up every time the game asks for something
+};
+MusicRequest music_request;
+SDL_mutex *music_lock=NULL;
+SDL_sem *music_wake=NULL; //posted when there's a new request or the mixer has used up a chunk
+SDL_Thread *music_thread=NULL;
+SDL_atomic_t music_quit;
+int music_song_id=0; //game thread's count of requests
+//the mixer's side, only touched by the audio callback
+int music_playing_id=0; //chunks from other requests get thrown out (older) or held back (newer)
+bool music_active=false; //if there's a song that hasn't reached its end yet
+int music_chunk_pos=0; //how far into the front chunk we are
+Sint16 music_gain=32767;
 
-//graphics stuff
-SDL_Window *window = NULL;
-SDL_Surface *window_surface = NULL; //this is only used in software blit mode
-SDL_Surface *program_surface = NULL; //game graphics all get drawn here, and then we scale it to the screen size
-SDL_Surface *sprites = NULL; //the loaded spritesheet
-SDL_Surface *font[4] = {NULL,NULL,NULL,NULL}; //generated fonts
-SDL_Renderer *renderer = NULL; //only used in hardware blit mode -- I could, and even should unify hardware and software final blitting to use the SDL2 renderer API, but really, this was bolted on after-the-fact
+//the decoder's side, only touched by the decode thread (or the game thread when rendering audio offline)
+MusicStream music_stream;
+int music_stream_id=0;
+bool music_end_sent=false;
 
-//display recording to files
-//TODO: some way to cancel video recording early
-const int VIDEO_TIME=(60*15);
-SDL_Surface *video_record[VIDEO_TIME];
-int frames_recorded=0; //if this is less than 0, recording is disabled
-bool recording=false;
+//do one bit of decoding work, returns false if there's nothing to do right now
+bool pumpMusic() {
+	SDL_LockMutex(music_lock);
+	MusicRequest request=music_request;
+	SDL_UnlockMutex(music_lock);
+	//new song (or no song at all)
+	if (request.song_id != music_stream_id) {
+		music_stream_id=request.song_id;
+		music_stream.close();
+		music_end_sent=false;
+		if (request.song >= 0 && music_stream.load(request.song, request.loop, synth_buffer.sample_rate())) {
+			QLOG(LOG_WARNING, LOG_AUDIO) << "couldn't find song " << request.song << " to play";
+		}
+	}
+	//decode as far ahead as we can
+	if (music_end_sent || music_chunks.count() >= MUSIC_CHUNKS-1) {
+		return false;
+	}
+	static MusicChunk chunk;
+	chunk.song_id=music_stream_id;
+	chunk.count=0;
+	//let the mixer know the song's over (or never started), so it doesn't think we're falling behind
+	if (music_stream.done) {
+		music_chunks.push(chunk);
+		music_end_sent=true;
+		return true;
+	}
+	chunk.count=music_stream.read(chunk.samples, MUSIC_CHUNK);
+	if (chunk.count > 0) {
+		music_chunks.push(chunk);
+	}
+	return true;
+}
 
-//setup recording
-//if this returns !=0, recording is disabled
-int initRecording() {
-	frames_recorded=0;
-	for (int ii=0; ii<VIDEO_TIME; ii++) {
-		video_record[ii]=NULL;
-		video_record[ii]=SDL_CreateRGBSurface(0, VIEW_WIDTH, VIEW_HEIGHT, 32, 0, 0, 0, 0);
-		//bail early if it fails
-		if (video_record[ii]==NULL) {
-			frames_recorded=-1;
-			std::cerr<<"error: could not create recording surfaces in memory, recording will not work\n";
-			return 1;
+//decode thread, keeps music_chunks topped up with whatever song was asked for last
+int musicThread(void *data) {
+	traceThread("quig music");
+	while (!SDL_AtomicGet(&music_quit)) {
+		bool pumped;
+		{
+			TRACE_SCOPE("decode music");
+			pumped=pumpMusic();
+		}
+		if (!pumped) {
+			SDL_SemWaitTimeout(music_wake, 100);
 		}
 	}
+	music_stream.close();
 	return 0;
 }
 
-//write a GIF
-//this used to do awful png frame dumping so it could be converted with ffmpeg later, but now we just use gif.h
-//we blend frames together to a: limit the amount and b: make the resulting output look nicer rather than just drop the frames entirely
-//TODO: add an option to merge frames or not and by how many (eg, support for 15fps GIF files would REALLY speed up the final save)
-//TODO: add an option to change what frames we record
-//TODO: doesn't Windows complain badly if we spend too long spinning on a task without updating the window? We need to look into that...
-int saveRecording() {
-	static int savenum; //TODO: name
-	//this really should only show up if I messed up somewhere
-	if (frames_recorded<=-1) {
-		std::cerr << "error: this message SHOULD NOT APPEAR; attempting to save recorded frames that don't exist!\n";
-		return 1;
+//start the decode thread, returns !=0 if music won't work
+int initMusic() {
+	if (!sound_active) {
+		return 0;
 	}
-	//SDL will convert from display format to AGBR format for gif.h
-	//colors were wrong without this
-	//TODO: GIF scale option, it outputs only at 1x right now
-	SDL_Surface *target_surf=SDL_CreateRGBSurface(0, VIEW_WIDTH, VIEW_HEIGHT, 32, 0x000000FF, 0x0000FF00, 0x00FF0000, 0);
-	//also, if you can't write to the current directory, this doesn't work
-	int gifdelay=3; //TODO: make configurable
-	//TODO: each invocation gets an increasing number for filename so you can save multiple clips
-	//generate filename
-	//std::stringstream outbuild;
-	//outbuild << "quig-record-" << std::setfill('0') << std::setw(4) << record_num << ".gif";
-	//std::string outname=outbuild.str();
-	GifWriter g;
-	GifBegin(&g, "quig-vid.gif", VIEW_WIDTH, VIEW_HEIGHT, gifdelay);
-	//TODO: have this go based on recorded frames (easy, but still requires testing at all)
-	for (int ii=0; ii<VIDEO_TIME; ii+=2) {
-		//we output the result at 30hz, with blended frames
-		SDL_SetSurfaceBlendMode(video_record[ii+1], SDL_BLENDMODE_BLEND);
-		SDL_SetSurfaceAlphaMod(video_record[ii+1],128);
-		//blend the odd frames onto the even ones
-		SDL_BlitSurface(video_record[ii+1], NULL, video_record[ii], NULL);
-		SDL_BlitSurface(video_record[ii], NULL, target_surf, NULL);
-		//write each frame
-		GifWriteFrame(&g, (uint8_t*)target_surf->pixels, VIEW_WIDTH, VIEW_HEIGHT, gifdelay);
+	music_lock=SDL_CreateMutex();
+	music_wake=SDL_CreateSemaphore(0);
+	//offline, the game thread does the decoding itself so it always happens at the same point
+	if (offline_audio) {
+		return 0;
+	}
+	if (music_lock && music_wake) {
+		music_thread=SDL_CreateThread(musicThread, "quig music", NULL);
+	}
+	if (!music_thread) {
+		QLOG(LOG_ERROR, LOG_AUDIO) << "could not start the music thread, music will not work! " << SDL_GetError();
+		return 1;
 	}
-	//save and return to game
-	GifEnd(&g);
-	SDL_FreeSurface(target_surf);
 	return 0;
 }
 
-//record frames, gets called every frame
-//possible todo: maybe we can actually always record, so pressing the record key would just write the circular buffer to disk?
-int doRecording() {
-	//bail if not recording anything
-	if (!recording) { 
+//ask the decode thread for a song, from the game thread, returns the id the mixer should wait for
+int requestSong(int song, bool loop) {
+	if (!music_lock) {
 		return 0;
 	}
-	//if recording can't work, error out
-	//really, I can't think of when this would show up and everything still works, but hey
-	if (frames_recorded<=-1) {
-		recording=false;
-		std::cerr<<"error: recording cannot happen!\n";
-		return 1;
+	SDL_LockMutex(music_lock);
+	music_request.song=song;
+	music_request.loop=loop;
+	music_request.song_id=++music_song_id;
+	SDL_UnlockMutex(music_lock);
+	SDL_SemPost(music_wake);
+	return music_song_id;
+}
+
+//mix whatever song is playing into the output, on the audio thread
+void runMusic(Sint16 *out, int count) {
+	MusicChunk *chunk;
+	while (count > 0 && music_active) {
+		chunk=music_chunks.peek();
+		if (!chunk) {
+			SDL_AtomicAdd(&music_underruns, 1);
+			return;
+		}
+		//left over from an old song (or a song the mixer hasn't got to yet)
+		if (chunk->song_id != music_playing_id) {
+			if (chunk->song_id - music_playing_id > 0) {
+				return;
+			}
+			music_chunks.drop();
+			music_chunk_pos=0;
+			continue;
+		}
+		if (chunk->count==0) {
+			music_active=false;
+			music_chunks.drop();
+			return;
+		}
+		int mix=min2(count, chunk->count-music_chunk_pos);
+		mixSamples(out, chunk->samples+music_chunk_pos, mix, music_gain);
+		out+=mix;
+		count-=mix;
+		music_chunk_pos+=mix;
+		if (music_chunk_pos >= chunk->count) {
+			music_chunks.drop();
+			music_chunk_pos=0;
+			SDL_SemPost(music_wake);
+		}
 	}
-	//copy frames
-	if (frames_recorded<VIDEO_TIME) {
-		//make sure we're overwriting instead of blending
-		SDL_SetSurfaceBlendMode(video_record[frames_recorded], SDL_BLENDMODE_NONE);
-		//copy frame to buffer
-		SDL_BlitSurface(program_surface, NULL, video_record[frames_recorded], NULL);
+}
+
+//stop the decode thread
+void stopMusic() {
+	if (!music_thread) {
+		return;
 	}
-	//increase the frame count, and write to disk if we've filled the buffer
-	frames_recorded++;
-	if (frames_recorded >= VIDEO_TIME) {
-		saveRecording();
-		frames_recorded=0;
-		recording=false;
+	SDL_AtomicSet(&music_quit, 1);
+	SDL_SemPost(music_wake);
+	SDL_WaitThread(music_thread, NULL);
+	music_thread=NULL;
+}
+
+//the mixer
+//all of the audio is generated in SDL's audio callback, on SDL's audio thread, so none of that work happens on the game thread
+//Lua's sound calls don't touch the synthesizer directly, they queue a command stamped with the frame they were made on
+//the callback plays back game frames a little behind the game, applying each frame's commands as it starts synthesizing that frame
+//so a command always lands on a frame boundary in the audio, no matter when during the frame the game made it or how jittery the frame timing is
+//
+//the game and the sound card run off different clocks (a "60hz" display might really be 59.94hz, or 62hz, or whatever) so the audio slowly drifts
+//rather than dropping or repeating audio to make up for it, we stretch the frames: the synthesizer runs slightly more or fewer clocks per game frame,
+//so a frame comes out as slightly more or fewer samples (the fraction of a clock left over carries into the next frame, so even a few ppm adds up properly)
+//this is done outside of Blip_Buffer on purpose, its clock rate only has steps of about 1000ppm at this many clocks per sample, which is as big as the whole correction
+//how far to nudge comes from a PI controller on how far behind the game the audio is
+const double AUDIO_TARGET_FILL=2; //how many frames behind the game the audio should run
+const double AUDIO_MAX_FILL=6; //if we drift this far from the game (either way, like after a stall or in turbo mode), just jump back to the target
+const double MIXER_GAIN_P=0.027; //rate change per frame of error
+const double MIXER_GAIN_I=0.0167; //rate change per frame-second of accumulated error
+const double MIXER_MAX_RATE=0.05; //never stretch by more than 5%, any more than that is audible and something else has gone wrong
+const double MIXER_FILTER=0.1; //how much each new fill measurement counts, the raw measurement is jittery and we don't want that in the pitch
+enum {
+	SOUND_TONE, SOUND_STOPVOICE, SOUND_PLAYSAMPLE, SOUND_STOPSAMPLE, SOUND_PLAYSONG
+};
+struct SoundCommand {
+	Uint32 frame; //the game frame this was issued on
+	int type;
+	int voice; //or channel, for samples
+	int wave; //or sound (or song) number, for samples and music
+	double freq;
+	int volume;
+	int frames; //or the request id, for songs
+	int decay;
+	bool short_noise;
+	bool loop;
+};
+SpscQueue<SoundCommand, 1024> sound_commands; //game thread pushes, audio callback pops
+SDL_atomic_t audio_game_frame; //the frame the game is on, so the callback knows how far behind it is
+SDL_atomic_t audio_game_ticks; //when the game got to that frame, so we can tell how far through it the game should be by now
+//the rest is only touched by the audio callback
+bool mixer_synced=false;
+Sint32 mixer_frame=0; //the game frame we're producing audio for
+blip_time_t mixer_frame_clocks=0; //how many synthesizer clocks make up a game frame, before any stretching
+blip_time_t mixer_run_clocks=0; //how many clocks the last frame actually ran for
+double mixer_clock_carry=0; //the part of a clock left over from the last frame
+double mixer_fill=AUDIO_TARGET_FILL; //filtered fill, in frames
+double mixer_integral=0; //accumulated error, in frame-seconds
+double mixer_rate=0; //the current rate correction, -0.05 to 0.05
+
+//queue a command for the mixer, from the game thread
+void queueSound(SoundCommand &cmd) {
+	if (!sound_active || sound_muted) {
+		return;
+	}
+	TRACE_SCOPE("queue sound");
+	cmd.frame=frame_number;
+	if (!sound_commands.push(cmd)) {
+		QLOG(LOG_WARNING, LOG_AUDIO) << "too many sound commands this frame, one was dropped";
 	}
-	return 0;
 }
 
-//maxN, minN -- compare numbers
-int max2(int a, int b) {
-	if (a>b) { return a; }
-	return b;
+//let the mixer know how far along the game is, from the game thread
+void publishGameFrame() {
+	//the order matters, see mixerFill()
+	SDL_AtomicSet(&audio_game_ticks, (int)SDL_GetTicks());
+	SDL_AtomicSet(&audio_game_frame, frame_number);
 }
-int max3(int a, int b, int c) {
-	return max2(a, max2(b, c));
+
+//carry out a command from the game, on the audio thread
+void runSoundCommand(const SoundCommand &cmd) {
+	SynthVoice &voice=synth_voices[cmd.voice % SYNTH_VOICES];
+	switch (cmd.type) {
+		case (SOUND_TONE):
+			voice.short_noise=cmd.short_noise;
+			voice.start(cmd.wave, cmd.freq, cmd.volume, cmd.frames, cmd.decay);
+		break;
+		case (SOUND_STOPVOICE):
+			voice.wave=0;
+		break;
+		case (SOUND_PLAYSAMPLE):
+			channels[cmd.voice].play(cmd.wave, cmd.volume, cmd.loop);
+		break;
+		case (SOUND_STOPSAMPLE):
+			channels[cmd.voice].sound=-1;
+		break;
+		case (SOUND_PLAYSONG):
+			//(stopping is just a request for no song)
+			music_playing_id=cmd.frames;
+			music_active=cmd.wave >= 0;
+			music_gain=(Sint16)(max2(0, min2(cmd.volume, SOUND_MAX_VOLUME))*32767/SOUND_MAX_VOLUME);
+		break;
+	}
 }
-int min2(int a, int b) {
-	if (a<b) { return a; }
-	return b;
+
+//how many frames behind the game the audio is right now, counting the part of a frame that's been synthesized but not handed to the device yet
+double mixerFill() {
+	//the game sets the ticks before the frame, so if it updates in between these we get an old frame with new ticks, and come up short by a frame at worst
+	//that's rare and gets filtered out anyway
+	Sint32 latest=SDL_AtomicGet(&audio_game_frame);
+	Uint32 ticks=(Uint32)SDL_AtomicGet(&audio_game_ticks);
+	double into_frame=(SDL_GetTicks()-ticks)*FPS_RATE/1000.0;
+	into_frame=into_frame < 0 ? 0 : (into_frame > 1 ? 1 : into_frame);
+	double frame_samples=(double)mixer_run_clocks*synth_buffer.sample_rate()/synth_buffer.clock_rate();
+	double played=mixer_frame+1-synth_buffer.samples_avail()/frame_samples;
+	return latest+into_frame-played;
 }
 
-//controller handling
-SDL_GameController *controller = NULL;
-//massive duplication of work because SDL handles controller input wildly differently than keyboard input
-//TODO: cleanup
-//TODO: multiple controllers
-struct ControllerState {
-	enum {
-		//TODO: rename the contents of this enum so it's more consistent with the Inputs struct
-		a=0,b,x,y,u,d,l,r,s,sel,end
-	};
-	int stick_up=0;
-	int stick_down=0;
-	int stick_left=0;
-	int stick_right=0;
-	int buttons[end];
-	int	button_quig_b=0; //buttons X and B on the Xbox-style layout
-	int button_quig_a=0; //buttons Y and A on the Xbox-style layout
-	//initialize buttons
-	ControllerState() {
-		for(int ii=0; ii<end; ii++) {
-			buttons[ii]=0;
-		}
-	}
-	//update the controller's state, we the mix this together with the keyboard input's state
-	void readState() {
-		//analog stick
-		int deadzone=13000; //TODO: move this
-		int jsx, jsy;
-		jsx=SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTX);
-		jsy=SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTY);
-		//TODO: this needs to be based on the stick angle and not just x/y position
-		//stick to right
-		if (jsx>deadzone) { 
-			stick_right++;
-			if (stick_right>2) {
-				stick_right=2;
-			}
-		}
-		else {
-			stick_right=0;
-		}
-		//stick to left
-		if (jsx<-deadzone) {
-			stick_left++;
-			if (stick_left>2) {
-				stick_left=2;
-			}
+//update the resampling rate, once per callback
+void updateMixerRate(int samples) {
+	if (!mixer_synced) {
+		return;
+	}
+	double dt=(double)samples/synth_buffer.sample_rate();
+	double fill=mixerFill();
+	mixer_fill+=(fill-mixer_fill)*MIXER_FILTER;
+	SDL_AtomicAdd(&audio_fill_hist[max2(0, min2((int)fill, AUDIO_FILL_BUCKETS-1))], 1);
+	double error=mixer_fill-AUDIO_TARGET_FILL;
+	//if the game's ahead, the audio needs to get through frames faster, so a higher clock rate and fewer samples per frame
+	mixer_integral+=error*dt;
+	double limit=MIXER_MAX_RATE/MIXER_GAIN_I;
+	mixer_integral=mixer_integral < -limit ? -limit : (mixer_integral > limit ? limit : mixer_integral);
+	mixer_rate=MIXER_GAIN_P*error+MIXER_GAIN_I*mixer_integral;
+	mixer_rate=mixer_rate < -MIXER_MAX_RATE ? -MIXER_MAX_RATE : (mixer_rate > MIXER_MAX_RATE ? MIXER_MAX_RATE : mixer_rate);
+	double device_frames=(double)audio_device_samples*FPS_RATE/synth_buffer.sample_rate();
+	SDL_AtomicSet(&audio_fill_us, (int)(mixer_fill*1000000/FPS_RATE));
+	SDL_AtomicSet(&audio_latency_us, (int)((mixer_fill+device_frames)*1000000/FPS_RATE));
+	SDL_AtomicSet(&audio_rate_ppm, (int)(mixer_rate*1000000));
+}
+
+//synthesize the next game frame into the buffer
+void runMixerFrame() {
+	mixer_frame++;
+	Sint32 latest=SDL_AtomicGet(&audio_game_frame);
+	Sint32 fill=latest-mixer_frame;
+	//the game's finished a frame once it's moved on to the next one
+	if (mixer_synced && fill < 1) {
+		SDL_AtomicAdd(&audio_underruns, 1);
+	}
+	if (!mixer_synced || fill < -AUDIO_MAX_FILL || fill > AUDIO_MAX_FILL) {
+		mixer_frame=latest-(Sint32)AUDIO_TARGET_FILL;
+		mixer_fill=AUDIO_TARGET_FILL;
+		mixer_synced=true;
+	}
+	SoundCommand *cmd;
+	while ((cmd=sound_commands.peek()) && (Sint32)cmd->frame <= mixer_frame) {
+		runSoundCommand(*cmd);
+		sound_commands.drop();
+	}
+	//if the game's ahead, the frame needs to come out shorter
+	double clocks=mixer_frame_clocks/(1+mixer_rate)+mixer_clock_carry;
+	mixer_run_clocks=(blip_time_t)clocks;
+	mixer_clock_carry=clocks-mixer_run_clocks;
+	for (int ii=0; ii<SYNTH_VOICES; ii++) {
+		synth_voices[ii].run(mixer_run_clocks);
+		//the length counters and envelopes run once per game frame
+		synth_voices[ii].tick();
+	}
+	synth_buffer.end_frame(mixer_run_clocks);
+}
+
+//set up the synthesizer for the given output rate
+//returns !=0 if there isn't enough memory
+int initSynth(int rate) {
+	//100ms is plenty, we only ever hold a frame or so
+	if (synth_buffer.set_sample_rate(rate, 100)) {
+		return 1;
+	}
+	long clock_rate=(long)rate*SYNTH_CLOCKS_SAMPLE;
+	mixer_frame_clocks=clock_rate/FPS_RATE;
+	mixer_run_clocks=mixer_frame_clocks;
+	synth_buffer.clock_rate(clock_rate);
+	synth.volume(0.1); //a single voice at full volume is about 10% of full scale, so all of them at once still fits
+	synth.output(&synth_buffer);
+	return 0;
+}
+
+//produce the next bit of audio, a frame at a time
+void mixAudio(Sint16 *out, int samples) {
+	while (samples > 0) {
+		if (synth_buffer.samples_avail()==0) {
+			runMixerFrame();
 		}
-		else {
-			stick_left=0;
+		int got=synth_buffer.read_samples(out, samples);
+		//shouldn't happen, but never hand the device garbage
+		if (got==0) {
+			memset(out, 0, samples*2);
+			break;
 		}
-		//stick down
-		if (jsy>deadzone) {
-			stick_down++;
-			if (stick_down>2) {
-				stick_down=2;
-			}
+		//a frame's synth output never straddles two reads, so samples started this frame start right on the frame
+		for (int ii=0; ii<NUM_CHANNELS; ii++) {
+			runChannel(channels[ii], out, got);
+		}
+		runMusic(out, got);
+		out+=got;
+		samples-=got;
+	}
+}
+
+//SDL's audio callback, fills the device's buffer
+void audioCallback(void *data, Uint8 *stream, int len) {
+	Uint64 start=SDL_GetPerformanceCounter();
+	//SDL made this thread, so it picks up the buffer that was made for it the first time through
+	if (!trace_local) {
+		trace_local=trace_audio;
+	}
+	updateMixerRate(len/2);
+	mixAudio((Sint16*)stream, len/2);
+	if (tracing()) {
+		traceEvent("mix audio", start, SDL_GetPerformanceCounter());
+	}
+	int took=(int)((SDL_GetPerformanceCounter()-start)*1000000/SDL_GetPerformanceFrequency());
+	//a rough average is all we need, and there's only ever one audio thread writing these
+	SDL_AtomicSet(&mixer_us, (SDL_AtomicGet(&mixer_us)*15+took)/16);
+	if (took > SDL_AtomicGet(&mixer_max_us)) {
+		SDL_AtomicSet(&mixer_max_us, took);
+	}
+}
+
+//WavWriter -- writes 16-bit mono audio to a .wav file as it comes in
+struct WavWriter {
+	FILE *file=NULL;
+	Uint32 samples=0;
+	bool failed=false;
+	//write the header, with the sizes filled in as best we know them
+	void writeHeader(int rate) {
+		std::vector<Uint8> header;
+		header.insert(header.end(), {'R','I','F','F'});
+		putU32(header, 36+samples*2);
+		header.insert(header.end(), {'W','A','V','E','f','m','t',' '});
+		putU32(header, 16);
+		putU16(header, 1); //PCM
+		putU16(header, 1); //mono
+		putU32(header, rate);
+		putU32(header, rate*2);
+		putU16(header, 2);
+		putU16(header, 16);
+		header.insert(header.end(), {'d','a','t','a'});
+		putU32(header, samples*2);
+		if (fwrite(header.data(), 1, header.size(), file) != header.size()) {
+			failed=true;
+		}
+	}
+	//returns !=0 if the file couldn't be opened
+	int open(const char *filename, int rate) {
+		file=fopen(filename, "wb");
+		if (!file) {
+			return 1;
+		}
+		samples=0;
+		failed=false;
+		writeHeader(rate);
+		return 0;
+	}
+	void write(const Sint16 *data, int count) {
+		std::vector<Uint8> buf;
+		buf.reserve(count*2);
+		for (int ii=0; ii<count; ii++) {
+			putU16(buf, (Uint16)data[ii]);
+		}
+		if (fwrite(buf.data(), 1, buf.size(), file) != buf.size()) {
+			failed=true;
+		}
+		samples+=count;
+	}
+	//go back and fill in the real sizes, returns !=0 if anything failed to write
+	int close(int rate) {
+		if (!file) {
+			return 0;
+		}
+		if (!fseek(file, 0, SEEK_SET)) {
+			writeHeader(rate);
+		}
+		if (fclose(file)) {
+			failed=true;
+		}
+		file=NULL;
+		return failed;
+	}
+};
+
+//offline audio
+//with --audio-out, there's no audio device, the game thread renders exactly one frame's worth of samples for every frame it runs and writes them out
+//nothing depends on how fast anything runs, so a replay always produces the exact same audio, headless, in fast-forward or otherwise
+WavWriter audio_out;
+Sint16 offline_frame[samples_frame]; //the last frame rendered, for GIF recording
+Uint64 offline_render_time=0; //in performance counter ticks, for benchmarking
+
+//render the current frame's audio, after step() has run
+void renderAudioFrame() {
+	Uint64 start=SDL_GetPerformanceCounter();
+	//same path as the callback, just with the mixer held to the game's frame and no stretching
+	while (pumpMusic()) {
+	}
+	SDL_AtomicSet(&audio_game_frame, frame_number+1); //this frame's done, as far as the mixer needs to know
+	mixer_synced=true;
+	mixer_frame=frame_number-1;
+	mixAudio(offline_frame, samples_frame);
+	offline_render_time+=SDL_GetPerformanceCounter()-start;
+	audio_out.write(offline_frame, samples_frame);
+}
+
+//show the arguments you can use
+void showHelp() {
+	std::cout
+		<< "\nusage:\n"
+		<< "  quig [arguments] gamefile\n"
+		<< "\narguments:\n"
+		<< "  -?, --help: show this help message here\n"
+		<< "  --soft: use software scaling for display (no vsync)\n"
+		<< "  --hard: use hardware scaling for display (no vsync) (default)\n"
+		<< "  --hard-vsync: use hardware scaling for display (vsync, display must run at 60hz)\n"
+		<< "  --fullscreen: run quig in fullscreen\n"
+		<< "  --window: run quig in a window (default)\n"
+		<< "  --auto-scale: automatically size the quig window (default)\n"
+		<< "  --scale n: scale the quig window by a given amount (eg, --scale 2)\n"
+		<< "  --no-sound: don't open an audio device at all\n"
+		<< "  --headless: run without a window, as fast as possible (eg, for replays)\n"
+		<< "  --no-sprite-cache: always decode the sprite sheet, instead of using (or making) a cached copy\n"
+		<< "  --watch: reload the game's code and sprites whenever they're saved\n"
+		<< "  --low-latency: wait until just before the frame is due to read input and run step(), instead of after drawing\n"
+		<< "  --turbo n: start in fast-forward, running n frames for each one shown (F5 toggles fast-forward)\n"
+		<< "  --capture file: stream every frame to a .y4m file for as long as quig runs (use - for stdout)\n"
+		<< "  --capture-raw: stream raw rgb24 frames instead of .y4m (for piping into an encoder)\n"
+		<< "  --capture-scale n: scale captured frames up by a whole number (eg, --capture-scale 4)\n"
+		<< "  --audio-buffer n: ask for an audio device buffer of n samples (default 1024, smaller is lower latency)\n"
+		<< "  --audio-out file: render audio to a .wav file, exactly a frame's worth per frame, instead of playing it\n"
+		<< "  --sshot-scale n: scale screenshots up by a whole number (eg, --sshot-scale 3)\n"
+		<< "  --record-input file: log every frame's input (and the random seed) to a file\n"
+		<< "  --log level: only show log messages up to a level (fatal, error, warning, notice, debug), eg, --log debug\n"
+		<< "  --log category=level: set the log level for just one category (core, video, audio, input, lua), eg, --log audio=debug\n"
+		<< "  --bindings file: load keyboard/controller bindings from a file (see readme.txt)\n"
+		<< "  --replay file: play back an input log instead of reading the keyboard/controller, then exit\n"
+		<< "  --hash-trace file: write a hash of every frame drawn to a file\n"
+		<< "  --hash-verify file: check every frame drawn against a file made with --hash-trace\n"
+		<< "  --hash-dump n: save frame n as a PNG\n"
+		<< "  --trace file.json: record how long startup and every frame took, for viewing in Perfetto or chrome://tracing\n"
+		;
+}
+
+
+//quig isn't hardware accelerated (at all, even though it probably could/should be)
+//but we do at least stretch the final screen size in hardware if asked to
+//and doing that is required for vsync
+enum class DisplayMode {
+	soft, hard_novsync, hard_vsync
+};
+DisplayMode display_mode=DisplayMode::hard_novsync; //TODO: make this a compile-time option for what is default?
+bool fullscreen=false; //TODO: fullscreen in software mode ignores aspect ratio, need to fix that
+
+int user_scale=-1; //how much the user wants the scale, -1 to pick automatically
+
+//run without a window at all, and as fast as possible (eg, for replays)
+bool headless=false;
+//fast-forward: run step() this many times for each frame actually shown
+int turbo_steps=4;
+bool turbo=false;
+//set while running a frame that won't be shown, the drawing functions skip all of their work when it's set
+bool render_skip=false;
+//set once the game reads pixels back with pget(), from then on every frame gets drawn, or what it reads would depend on fast-forward
+bool pixels_read=false;
+//sleep before reading input instead of after drawing, so the input is as fresh as possible (see FramePacer)
+bool low_latency=false;
+//keep decoded sprite sheets around between runs (see loadSprites())
+bool sprite_cache_enabled=true;
+//reload the game's code and sprites when they change (see FileWatcher)
+bool watch_enabled=false;
+
+//streaming capture settings (see initCapture())
+std::string capture_name=""; //empty if we aren't capturing, "-" for stdout
+std::string audio_out_name=""; //empty unless we're rendering audio to a file instead of playing it
+bool capture_raw=false; //raw rgb24 instead of .y4m
+int capture_scale=1;
+int sshot_scale=1; //scale factor for saved screenshots
+
+//input log settings (see InputLog)
+std::string record_input_name=""; //--record-input file
+std::string replay_name=""; //--replay file
+std::string bindings_name=""; //--bindings file (see loadBindings())
+std::string hash_trace_name=""; //--hash-trace file
+std::string hash_verify_name=""; //--hash-verify file
+int hash_dump_frame=-1; //--hash-dump frame
+
+//read a whole number argument that follows an option
+//returns false (after complaining) if there isn't one or it doesn't make sense
+bool readIntArg(int argc, char **argv, int &ii, const char *what, int &result) {
+	//bail if we run out of arguments
+	if (ii+1 >= argc) {
+		QLOG(LOG_FATAL, LOG_CORE) << "no " << what << " given!";
+		return false;
+	}
+	ii++;
+	std::string sub_arg=argv[ii];
+	try {
+		result=std::stoi(sub_arg);
+	}
+	catch (std::logic_error&) {
+		QLOG(LOG_FATAL, LOG_CORE) << "could not understand '" << sub_arg << "' as a " << what << "!";
+		return false;
+	}
+	return true;
+}
+
+//parse the arugment list
+int handleArgs(int argc, char **argv) {
+	std::string current="";
+	for (int ii=0; ii<argc; ii++) {
+		current=argv[ii];
+		QLOG(LOG_DEBUG, LOG_CORE) << "arg #" << ii << ": '" << current << "'";
+		//empty argument
+		if (current.size()<1) {
+			continue;
+		}
+		//handle arguments
+		//quig allows the same argument to be repeated (eg, if you have a script that has default settings, but allows them to be changed), the most recent argument is the one that is used
+		//nothing stops you from running quig like
+		//  $ quig default.quig --scale 4 --hard-vsync ~/mygame.quig --auto-scale --hard
+		//where it'll end up using automatic scale, no v-sync, and run ~/mygame.quig instead of default.quig
+		if (current[0]=='-') {
+			//software mode, no v-sync
+			if (current=="--soft") {
+				display_mode=DisplayMode::soft;
+			}
+			//hardware mode, no v-sync
+			else if (current=="--hard") {
+				display_mode=DisplayMode::hard_novsync;
+			}
+			//hardware mode, v-sync
+			else if (current=="--hard-vsync") {
+				display_mode=DisplayMode::hard_vsync;
+			}
+			//fullscreen
+			else if (current=="--fullscreen") {
+				fullscreen=true;
+			}
+			//windowed
+			else if (current=="--window") {
+				fullscreen=false;
+			}
+			//automatic scale (a quig window that comfortably fits on screen)
+			else if (current=="--auto-scale") {
+				user_scale=-1;
+			}
+			//user-defined scale
+			else if (current=="--scale") {
+				//attempt to get next arg
+				//bail if we run out of arguments
+				if (ii+1 >=argc) {
+					QLOG(LOG_FATAL, LOG_CORE) << "no scale factor given!";
+					return 1;
+				}
+				//advance the argument list, grab and convert the next argument
+				ii++;
+				std::string sub_arg=argv[ii];
+				try {
+					user_scale=std::stoi(sub_arg);
+				}
+				//std::logic_error is the parent to all of the stoi exceptions
+				catch (std::logic_error) { 
+					QLOG(LOG_FATAL, LOG_CORE) << "could not understand '" << sub_arg << "' as a scale factor!";
+					return 1;
+				}
+				//bad size -- dunno if this will get adjusted if quig supports non-integer scale factors
+				if (user_scale<1) {
+					QLOG(LOG_FATAL, LOG_CORE) << "invalid size '" << user_scale << "'!";
+					return 1;
+				}
+			}
+			//no audio
+			else if (current=="--no-sound") {
+				sound_enabled=false;
+			}
+			//no window
+			else if (current=="--headless") {
+				headless=true;
+			}
+			//always decode the PNG
+			else if (current=="--no-sprite-cache") {
+				sprite_cache_enabled=false;
+			}
+			//hot reloading
+			else if (current=="--watch") {
+				watch_enabled=true;
+			}
+			//late input polling
+			else if (current=="--low-latency") {
+				low_latency=true;
+			}
+			//fast-forward
+			else if (current=="--turbo") {
+				if (!readIntArg(argc, argv, ii, "fast-forward speed", turbo_steps)) {
+					return 1;
+				}
+				if (turbo_steps<1) {
+					QLOG(LOG_FATAL, LOG_CORE) << "invalid fast-forward speed '" << turbo_steps << "'!";
+					return 1;
+				}
+				turbo=true;
+			}
+			//stream frames to a file or pipe
+			else if (current=="--capture") {
+				if (ii+1 >= argc) {
+					QLOG(LOG_FATAL, LOG_CORE) << "no capture file given!";
+					return 1;
+				}
+				ii++;
+				capture_name=argv[ii];
+			}
+			//audio device buffer size
+			else if (current=="--audio-buffer") {
+				if (!readIntArg(argc, argv, ii, "audio buffer size", buffer_len)) {
+					return 1;
+				}
+				if (buffer_len < 32 || buffer_len > 16384) {
+					QLOG(LOG_FATAL, LOG_CORE) << "invalid audio buffer size '" << buffer_len << "'! (try 256 to 4096)";
+					return 1;
+				}
+			}
+			//render audio to a file instead of a device
+			else if (current=="--audio-out") {
+				if (ii+1 >= argc) {
+					QLOG(LOG_FATAL, LOG_CORE) << "no audio file given!";
+					return 1;
+				}
+				ii++;
+				audio_out_name=argv[ii];
+			}
+			//raw frames instead of .y4m
+			else if (current=="--capture-raw") {
+				capture_raw=true;
+			}
+			//capture scale factor
+			else if (current=="--capture-scale") {
+				if (!readIntArg(argc, argv, ii, "capture scale factor", capture_scale)) {
+					return 1;
+				}
+				if (capture_scale<1 || capture_scale>8) {
+					QLOG(LOG_FATAL, LOG_CORE) << "invalid capture scale '" << capture_scale << "'!";
+					return 1;
+				}
+			}
+			//screenshot scale factor
+			else if (current=="--sshot-scale") {
+				if (!readIntArg(argc, argv, ii, "screenshot scale factor", sshot_scale)) {
+					return 1;
+				}
+				if (sshot_scale<1 || sshot_scale>8) {
+					QLOG(LOG_FATAL, LOG_CORE) << "invalid screenshot scale '" << sshot_scale << "'!";
+					return 1;
+				}
+			}
+			//log inputs for replay
+			else if (current=="--record-input") {
+				if (ii+1 >= argc) {
+					QLOG(LOG_FATAL, LOG_CORE) << "no input log file given!";
+					return 1;
+				}
+				ii++;
+				record_input_name=argv[ii];
+			}
+			//log levels
+			else if (current=="--log") {
+				if (ii+1 >= argc) {
+					QLOG(LOG_FATAL, LOG_CORE) << "no log level given!";
+					return 1;
+				}
+				ii++;
+				if (!setLogLevel(argv[ii])) {
+					QLOG(LOG_FATAL, LOG_CORE) << "could not understand '" << argv[ii] << "' as a log level!";
+					return 1;
+				}
+			}
+			//remap keys and buttons
+			else if (current=="--bindings") {
+				if (ii+1 >= argc) {
+					QLOG(LOG_FATAL, LOG_CORE) << "no bindings file given!";
+					return 1;
+				}
+				ii++;
+				bindings_name=argv[ii];
+			}
+			//replay logged inputs
+			else if (current=="--replay") {
+				if (ii+1 >= argc) {
+					QLOG(LOG_FATAL, LOG_CORE) << "no input log file given!";
+					return 1;
+				}
+				ii++;
+				replay_name=argv[ii];
+			}
+			//write out frame hashes
+			else if (current=="--hash-trace") {
+				if (ii+1 >= argc) {
+					QLOG(LOG_FATAL, LOG_CORE) << "no hash trace file given!";
+					return 1;
+				}
+				ii++;
+				hash_trace_name=argv[ii];
+			}
+			//check frame hashes
+			else if (current=="--hash-verify") {
+				if (ii+1 >= argc) {
+					QLOG(LOG_FATAL, LOG_CORE) << "no hash trace file given!";
+					return 1;
+				}
+				ii++;
+				hash_verify_name=argv[ii];
+			}
+			//save a single frame
+			else if (current=="--hash-dump") {
+				if (!readIntArg(argc, argv, ii, "frame number", hash_dump_frame)) {
+					return 1;
+				}
+			}
+			//timing trace
+			else if (current=="--trace") {
+				if (ii+1 >= argc) {
+					QLOG(LOG_FATAL, LOG_CORE) << "no trace file given!";
+					return 1;
+				}
+				ii++;
+				trace_name=argv[ii];
+			}
+			//show help (also, immediately stops argument handling)
+			else if (current == "-?" || current == "--help") {
+				showHelp();
+				return 2;
+			}
+			//unknown argument
+			else {
+				QLOG(LOG_FATAL, LOG_CORE) << "unknown argument '"<< current << "'!";
+				showHelp();
+				return 1;
+			}
+			
+		}
+		//anything that isn't an argument is a game name, and we run the last one specified
+		else {
+			arg_name=current;
+		}
+	}
+	if (!record_input_name.empty() && !replay_name.empty()) {
+		QLOG(LOG_FATAL, LOG_CORE) << "can't record inputs while replaying them!";
+		return 1;
+	}
+	return 0;
+}
+
+//pick the window size, which has to wait until SDL's video is up so we can ask about the display
+void pickWindowScale() {
+	int size=-1; //automatically set the screen scale based on screen width and screen height (minus 64)
+	//limit the display size to 3x in software mode because software scaling rapidly gets slow as the size increases
+	int xscale=1,yscale=1;
+	if (size==-1) {
+		SDL_DisplayMode mode;
+		//get a window size that'll fit entirely on the screen, including things like window borders, taskbars, etc
+		//TODO: look into how things are dealt with when working with multiple monitors, we just get the first display here
+		//really would be nice to know what monitor a window will be on before we put it there
+		if (!SDL_GetCurrentDisplayMode(0, &mode)) {
+			xscale=(mode.w-16)/VIEW_WIDTH;
+			yscale=(mode.h-64)/VIEW_HEIGHT; //yeah, this is a bit high, but a 720px window doesn't actually fit on a 768px display because of title/borders/taskbar
+			QLOG(LOG_DEBUG, LOG_VIDEO) << "screen scale values are " << xscale << "," << yscale;
+		}
+		//this shouldn't happen, but maybe quig's being run on something weird?
+		else {
+			QLOG(LOG_ERROR, LOG_VIDEO) << "could not get display information! Auto-scale will not work.";
+		}
+		//set auto-scale
+		if (user_scale==-1) {
+			setWindowScale(min2(xscale,yscale));
+		}
+		//set user scale
+		else {
+			setWindowScale(user_scale);
+		}
+		//limit the size of software scaling because it's very slow and if you're running quig in software scale mode, you probably aren't (or shouldn't be) driving a high-res screen
+		if (display_mode==DisplayMode::soft && window_scale > 3) {
+			setWindowScale(3);
+		}
+	}
+}
+
+//graphics stuff
+SDL_Window *window = NULL;
+SDL_Surface *window_surface = NULL; //this is only used in software blit mode
+SDL_Surface *program_surface = NULL; //game graphics all get drawn here, and then we scale it to the screen size
+SDL_Surface *draw_target = NULL; //where the drawing functions actually draw: program_surface, unless the game picked a canvas with target()
+SDL_Surface *sprites = NULL; //the loaded spritesheet
+SDL_Surface *font[4] = {NULL,NULL,NULL,NULL}; //generated fonts
+SDL_Renderer *renderer = NULL; //only used in hardware blit mode -- I could, and even should unify hardware and software final blitting to use the SDL2 renderer API, but really, this was bolted on after-the-fact
+
+//display recording to files
+//TODO: some way to cancel video recording early
+const int VIDEO_TIME=(60*15);
+SDL_Surface *video_record[VIDEO_TIME];
+int frames_recorded=0; //if this is less than 0, recording is disabled
+bool recording=false;
+std::vector<Sint16> record_audio; //with --audio-out, the GIF gets a matching .wav
+
+//setup recording
+//if this returns !=0, recording is disabled
+int initRecording() {
+	frames_recorded=0;
+	for (int ii=0; ii<VIDEO_TIME; ii++) {
+		video_record[ii]=NULL;
+		video_record[ii]=SDL_CreateRGBSurface(0, VIEW_WIDTH, VIEW_HEIGHT, 32, 0, 0, 0, 0);
+		//bail early if it fails
+		if (video_record[ii]==NULL) {
+			frames_recorded=-1;
+			QLOG(LOG_ERROR, LOG_VIDEO) << "could not create recording surfaces in memory, recording will not work";
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//write a GIF
+//this used to do awful png frame dumping so it could be converted with ffmpeg later, but now we just use gif.h
+//we blend frames together to a: limit the amount and b: make the resulting output look nicer rather than just drop the frames entirely
+//TODO: add an option to merge frames or not and by how many (eg, support for 15fps GIF files would REALLY speed up the final save)
+//TODO: add an option to change what frames we record
+//TODO: doesn't Windows complain badly if we spend too long spinning on a task without updating the window? We need to look into that...
+int saveRecording() {
+	TRACE_SCOPE("save gif");
+	static int savenum; //TODO: name
+	//this really should only show up if I messed up somewhere
+	if (frames_recorded<=-1) {
+		QLOG(LOG_ERROR, LOG_VIDEO) << "this message SHOULD NOT APPEAR; attempting to save recorded frames that don't exist!";
+		return 1;
+	}
+	//SDL will convert from display format to AGBR format for gif.h
+	//colors were wrong without this
+	//TODO: GIF scale option, it outputs only at 1x right now
+	SDL_Surface *target_surf=SDL_CreateRGBSurface(0, VIEW_WIDTH, VIEW_HEIGHT, 32, 0x000000FF, 0x0000FF00, 0x00FF0000, 0);
+	//also, if you can't write to the current directory, this doesn't work
+	int gifdelay=3; //TODO: make configurable
+	//TODO: each invocation gets an increasing number for filename so you can save multiple clips
+	//generate filename
+	//std::stringstream outbuild;
+	//outbuild << "quig-record-" << std::setfill('0') << std::setw(4) << record_num << ".gif";
+	//std::string outname=outbuild.str();
+	GifWriter g;
+	GifBegin(&g, "quig-vid.gif", VIEW_WIDTH, VIEW_HEIGHT, gifdelay);
+	//TODO: have this go based on recorded frames (easy, but still requires testing at all)
+	for (int ii=0; ii<VIDEO_TIME; ii+=2) {
+		//we output the result at 30hz, with blended frames
+		SDL_SetSurfaceBlendMode(video_record[ii+1], SDL_BLENDMODE_BLEND);
+		SDL_SetSurfaceAlphaMod(video_record[ii+1],128);
+		//blend the odd frames onto the even ones
+		SDL_BlitSurface(video_record[ii+1], NULL, video_record[ii], NULL);
+		SDL_BlitSurface(video_record[ii], NULL, target_surf, NULL);
+		//write each frame
+		GifWriteFrame(&g, (uint8_t*)target_surf->pixels, VIEW_WIDTH, VIEW_HEIGHT, gifdelay);
+	}
+	//save and return to game
+	GifEnd(&g);
+	SDL_FreeSurface(target_surf);
+	if (offline_audio) {
+		WavWriter wav;
+		if (wav.open("quig-vid.wav", sound_freq)) {
+			QLOG(LOG_ERROR, LOG_VIDEO) << "could not write quig-vid.wav!";
+			return 1;
+		}
+		wav.write(record_audio.data(), (int)record_audio.size());
+		wav.close(sound_freq);
+	}
+	return 0;
+}
+
+//record frames, gets called every frame
+//possible todo: maybe we can actually always record, so pressing the record key would just write the circular buffer to disk?
+int doRecording() {
+	//bail if not recording anything
+	if (!recording) { 
+		return 0;
+	}
+	//if recording can't work, error out
+	//really, I can't think of when this would show up and everything still works, but hey
+	if (frames_recorded<=-1) {
+		recording=false;
+		QLOG(LOG_ERROR, LOG_VIDEO) << "recording cannot happen!";
+		return 1;
+	}
+	//copy frames
+	if (frames_recorded<VIDEO_TIME) {
+		//make sure we're overwriting instead of blending
+		SDL_SetSurfaceBlendMode(video_record[frames_recorded], SDL_BLENDMODE_NONE);
+		//copy frame to buffer
+		SDL_BlitSurface(program_surface, NULL, video_record[frames_recorded], NULL);
+		if (offline_audio) {
+			if (frames_recorded==0) {
+				record_audio.clear();
+			}
+			record_audio.insert(record_audio.end(), offline_frame, offline_frame+samples_frame);
+		}
+	}
+	//increase the frame count, and write to disk if we've filled the buffer
+	frames_recorded++;
+	if (frames_recorded >= VIDEO_TIME) {
+		saveRecording();
+		frames_recorded=0;
+		recording=false;
+	}
+	return 0;
+}
+
+//a finished frame handed from the game thread to a worker thread
+struct FrameItem {
+	int buffer; //which pool buffer holds the pixels, -1 tells the worker to quit
+	Uint32 frame; //which frame it was
+};
+
+//FramePool -- a set of frame-sized buffers shared between the game thread and one worker thread
+//the game thread copies a frame into a free buffer and queues it, the worker hands the buffer back once it's done with it
+//if every buffer is busy, the frame gets dropped instead of holding up step()
+template<int N>
+struct FramePool {
+	Uint32 *buffers[N];
+	SpscQueue<int, N+1> free_buffers; //worker pushes, game thread pops
+	SpscQueue<FrameItem, N+2> queued; //game thread pushes, worker pops (+1 for the quit message)
+	SDL_sem *ready=NULL; //posted once per queued item
+	int dropped=0; //only touched by the game thread
+	//allocate everything, returns false if we're out of memory
+	bool init() {
+		ready=SDL_CreateSemaphore(0);
+		if (!ready) {
+			return false;
+		}
+		for (int ii=0; ii<N; ii++) {
+			buffers[ii]=new (std::nothrow) Uint32[VIEW_WIDTH*VIEW_HEIGHT];
+			if (!buffers[ii]) {
+				return false;
+			}
+			free_buffers.push(ii);
+		}
+		return true;
+	}
+	//copy a surface into a free buffer and queue it, returns false if the frame had to be dropped
+	bool submit(SDL_Surface *src, Uint32 frame) {
+		FrameItem item;
+		if (!free_buffers.pop(item.buffer)) {
+			dropped++;
+			return false;
+		}
+		item.frame=frame;
+		Uint8 *row=(Uint8*)src->pixels;
+		for (int yy=0; yy<VIEW_HEIGHT; yy++) {
+			memcpy(buffers[item.buffer]+yy*VIEW_WIDTH, row+yy*src->pitch, VIEW_WIDTH*4);
+		}
+		queued.push(item);
+		SDL_SemPost(ready);
+		return true;
+	}
+	//(worker side) sleep until there's a frame to deal with
+	FrameItem wait() {
+		FrameItem item={-1,0};
+		SDL_SemWait(ready);
+		queued.pop(item);
+		return item;
+	}
+	//(worker side) give a buffer back once it's been used
+	void release(int buffer) {
+		free_buffers.push(buffer);
+	}
+	//ask the worker to finish up once it's gone through everything already queued
+	void quit() {
+		FrameItem item={-1,0};
+		queued.push(item);
+		SDL_SemPost(ready);
+	}
+	//how many frames are waiting on the worker
+	int backlog() {
+		return queued.count();
+	}
+};
+
+//streaming video capture
+//unlike the GIF recording, this writes every single frame for as long as quig runs
+//the game thread only copies the frame into a pool buffer, the writer thread does the scaling, conversion, and actual writing
+//so a slow disk or a stalled pipe costs us dropped frames (which get counted) instead of stalling the game
+//.y4m is taken directly by ffmpeg, mpv, and most other video tools; raw rgb24 is meant for piping, eg:
+//  $ quig --capture - --capture-raw game.quig | ffmpeg -f rawvideo -pix_fmt rgb24 -s 240x144 -r 60 -i - out.mp4
+const int CAPTURE_FRAMES=32; //about half a second of slack before we start dropping frames
+FramePool<CAPTURE_FRAMES> capture_pool;
+SDL_Thread *capture_thread=NULL;
+FILE *capture_file=NULL;
+SDL_atomic_t capture_failed; //set by the writer if a write fails, we stop sending frames after that
+int capture_written=0; //frames actually written, only touched by the writer until it's been joined
+
+//convert and write one frame, runs on the writer thread
+//returns false if the write failed
+bool writeCaptureFrame(const Uint32 *px, std::vector<Uint8> &out) {
+	const SDL_PixelFormat *fmt=program_surface->format;
+	int w=VIEW_WIDTH*capture_scale;
+	int h=VIEW_HEIGHT*capture_scale;
+	int plane=w*h;
+	//each output pixel is built from the source pixel it scales up from
+	//this just repeats each pixel/row capture_scale times -- fine, since it's off the game thread
+	for (int yy=0; yy<h; yy++) {
+		const Uint32 *src_row=px+(yy/capture_scale)*VIEW_WIDTH;
+		for (int xx=0; xx<w; xx++) {
+			Uint32 p=src_row[xx/capture_scale];
+			int r=(p>>fmt->Rshift)&0xFF;
+			int g=(p>>fmt->Gshift)&0xFF;
+			int b=(p>>fmt->Bshift)&0xFF;
+			int pos=yy*w+xx;
+			if (capture_raw) {
+				out[pos*3]=r;
+				out[pos*3+1]=g;
+				out[pos*3+2]=b;
+			}
+			//BT.601 studio range, 4:4:4 so we don't have to average anything
+			else {
+				out[pos]=((66*r + 129*g + 25*b + 128) >> 8) + 16;
+				out[plane+pos]=((-38*r - 74*g + 112*b + 128) >> 8) + 128;
+				out[plane*2+pos]=((112*r - 94*g - 18*b + 128) >> 8) + 128;
+			}
+		}
+	}
+	if (!capture_raw && fputs("FRAME\n", capture_file) < 0) {
+		return false;
+	}
+	return fwrite(out.data(), 1, out.size(), capture_file) == out.size();
+}
+
+//the writer thread itself
+int captureThread(void *data) {
+	std::vector<Uint8> out(VIEW_WIDTH*capture_scale * VIEW_HEIGHT*capture_scale * 3);
+	traceThread("quig capture");
+	while (true) {
+		FrameItem item=capture_pool.wait();
+		if (item.buffer<0) {
+			break;
+		}
+		TRACE_SCOPE("write capture frame");
+		//once something's gone wrong, just throw frames away until we're told to stop
+		if (!SDL_AtomicGet(&capture_failed)) {
+			if (writeCaptureFrame(capture_pool.buffers[item.buffer], out)) {
+				capture_written++;
+			}
+			else {
+				SDL_AtomicSet(&capture_failed, 1);
+			}
+		}
+		capture_pool.release(item.buffer);
+	}
+	fflush(capture_file);
+	return 0;
+}
+
+//set up capture, if it was asked for
+//if this returns !=0, capture is disabled
+int initCapture() {
+	if (capture_name.empty()) {
+		return 0;
+	}
+	SDL_AtomicSet(&capture_failed, 0);
+	if (capture_name=="-") {
+		capture_file=stdout;
+		#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+		#else
+		//if whatever we're piping to goes away, we want a failed write, not to get killed
+		signal(SIGPIPE, SIG_IGN);
+		#endif
+	}
+	else {
+		capture_file=fopen(capture_name.c_str(), "wb");
+	}
+	if (!capture_file) {
+		QLOG(LOG_ERROR, LOG_VIDEO) << "could not open '" << capture_name << "' for capture, capture will not work";
+		capture_name="";
+		return 1;
+	}
+	if (!capture_pool.init()) {
+		QLOG(LOG_ERROR, LOG_VIDEO) << "could not create capture buffers in memory, capture will not work";
+		capture_name="";
+		return 1;
+	}
+	if (!capture_raw) {
+		fprintf(capture_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", VIEW_WIDTH*capture_scale, VIEW_HEIGHT*capture_scale, FPS_RATE);
+	}
+	capture_thread=SDL_CreateThread(captureThread, "quig capture", NULL);
+	if (!capture_thread) {
+		QLOG(LOG_ERROR, LOG_VIDEO) << "could not start capture thread, capture will not work! " << SDL_GetError();
+		capture_name="";
+		return 1;
+	}
+	QLOG(LOG_NOTICE, LOG_VIDEO) << "capturing video to '" << capture_name << "' at " << capture_scale << "x scale";
+	return 0;
+}
+
+//queue the current frame for capture, gets called every frame
+int doCapture() {
+	if (!capture_thread) {
+		return 0;
+	}
+	if (SDL_AtomicGet(&capture_failed)) {
+		return 1;
+	}
+	capture_pool.submit(program_surface, frame_number);
+	return 0;
+}
+
+//let the writer drain what's left, then report how it went
+void stopCapture() {
+	if (!capture_thread) {
+		return;
+	}
+	capture_pool.quit();
+	SDL_WaitThread(capture_thread, NULL);
+	capture_thread=NULL;
+	if (SDL_AtomicGet(&capture_failed)) {
+		QLOG(LOG_ERROR, LOG_VIDEO) << "writing to '" << capture_name << "' failed partway, the capture is incomplete!";
+	}
+	QLOG(LOG_NOTICE, LOG_VIDEO) << "capture finished: " << capture_written << " frames written, " << capture_pool.dropped << " frames dropped";
+	if (capture_file!=stdout) {
+		fclose(capture_file);
+	}
+	capture_file=NULL;
+}
+
+//SDL_image only gets started up when something actually needs it: with a sprite cache hit (see loadSprites()) nothing does
+//call this before using it, returns false if it can't be started
+//it's called from the sprites task during startup and from the main thread after that, so it's locked in case they ever overlap
+bool initImage() {
+	static SDL_SpinLock lock=0;
+	static bool ready=false;
+	SDL_AtomicLock(&lock);
+	if (!ready) {
+		int img_flags=IMG_INIT_PNG;
+		if ((IMG_Init(img_flags) & img_flags) != img_flags) {
+			SDL_AtomicUnlock(&lock);
+			QLOG(LOG_ERROR, LOG_VIDEO) << "could not initialize SDL_image! " << IMG_GetError();
+			return false;
+		}
+		ready=true;
+	}
+	SDL_AtomicUnlock(&lock);
+	return true;
+}
+
+//screenshots
+//pressing F6 just copies the frame into a pool buffer, the PNG compression and writing happen on a separate thread
+//shots are numbered (quig-sshot-0001.png, quig-sshot-0002.png...), skipping any numbers already taken in the current directory, so nothing gets overwritten
+//the pool is big enough that mashing F6 shouldn't drop any, but if it does, we say so
+const int SSHOT_FRAMES=8;
+FramePool<SSHOT_FRAMES> sshot_pool;
+SDL_Thread *sshot_thread=NULL;
+
+//check if a file exists (well, if we can open it, which is close enough)
+bool fileExists(const std::string &name) {
+	FILE *ff=fopen(name.c_str(), "rb");
+	if (ff) {
+		fclose(ff);
+		return true;
+	}
+	return false;
+}
+
+//generate a screenshot filename
+std::string sshotName(int num) {
+	std::stringstream name;
+	name << "quig-sshot-" << std::setfill('0') << std::setw(4) << num << ".png";
+	return name.str();
+}
+
+//the screenshot thread itself
+int sshotThread(void *data) {
+	int num=1;
+	int w=VIEW_WIDTH*sshot_scale;
+	int h=VIEW_HEIGHT*sshot_scale;
+	SDL_Surface *out=SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, program_surface->format->format);
+	traceThread("quig screenshots");
+	while (true) {
+		FrameItem item=sshot_pool.wait();
+		if (item.buffer<0) {
+			break;
+		}
+		TRACE_SCOPE("save screenshot");
+		if (out) {
+			//scale up by repeating pixels
+			const Uint32 *px=sshot_pool.buffers[item.buffer];
+			for (int yy=0; yy<h; yy++) {
+				Uint32 *row=(Uint32*)((Uint8*)out->pixels+yy*out->pitch);
+				const Uint32 *src_row=px+(yy/sshot_scale)*VIEW_WIDTH;
+				for (int xx=0; xx<w; xx++) {
+					row[xx]=src_row[xx/sshot_scale];
+				}
+			}
+			//skip past any shots from earlier runs
+			while (fileExists(sshotName(num))) {
+				num++;
+			}
+			std::string name=sshotName(num);
+			if (IMG_SavePNG(out, name.c_str())) {
+				QLOG(LOG_ERROR, LOG_VIDEO) << "could not save screenshot '" << name << "'! " << IMG_GetError();
+			}
+			else {
+				QLOG(LOG_NOTICE, LOG_VIDEO) << "saved screenshot '" << name << "'";
+			}
+			num++;
+		}
+		sshot_pool.release(item.buffer);
+	}
+	SDL_FreeSurface(out);
+	return 0;
+}
+
+//set up the screenshot pool and thread
+//if this returns !=0, screenshots are disabled
+int initScreenshots() {
+	if (!sshot_pool.init()) {
+		QLOG(LOG_ERROR, LOG_VIDEO) << "could not create screenshot buffers in memory, screenshots will not work";
+		return 1;
+	}
+	sshot_thread=SDL_CreateThread(sshotThread, "quig screenshots", NULL);
+	if (!sshot_thread) {
+		QLOG(LOG_ERROR, LOG_VIDEO) << "could not start screenshot thread, screenshots will not work! " << SDL_GetError();
+		return 1;
+	}
+	return 0;
+}
+
+//queue the current frame to be saved as a screenshot
+void takeScreenshot(Uint32 frame) {
+	if (!sshot_thread || !initImage()) {
+		return;
+	}
+	if (!sshot_pool.submit(program_surface, frame)) {
+		QLOG(LOG_WARNING, LOG_VIDEO) << "screenshots are still being saved, this one was dropped";
+	}
+}
+
+//finish saving any screenshots that are still queued up
+void stopScreenshots() {
+	if (!sshot_thread) {
+		return;
+	}
+	sshot_pool.quit();
+	SDL_WaitThread(sshot_thread, NULL);
+	sshot_thread=NULL;
+}
+
+//maxN, minN -- compare numbers
+int max2(int a, int b) {
+	if (a>b) { return a; }
+	return b;
+}
+int max3(int a, int b, int c) {
+	return max2(a, max2(b, c));
+}
+int min2(int a, int b) {
+	if (a<b) { return a; }
+	return b;
+}
+
+//holds the average fps, we calculate it once a second
+double avg_fps=0.0;
+
+//lua interpreter
+lua_State *L;
+
+//setPixel -- plot a single pixel to a surface
+//no idea why this isn't a SDL built-in in some way
+void setPixel(SDL_Surface *target, int x, int y, Uint32 color) {
+	Uint32 *px = (Uint32 *)target->pixels;
+	px[y*target->w+x]=color;
+}
+
+//generateFont -- convert the font data
+//we call this four times to generate each variation
+//this is kinda ugly but whatever
+//TODO: we probably don't need to fill the background, having it as part of the character causes ugly scaling artifacts
+//maybe we'll just draw the rectangle as ceil(scale)
+SDL_Surface* generateFont(int mode) {
+	//font holds up to 256 chracters, but large portions are empty
+	if (mode >= 4 || mode < 0) {
+		return NULL;
+	}
+	//make a tall surface holding everything
+	font[mode] = SDL_CreateRGBSurface(0, 8, 8*256, 32, 0, 0, 0, 0);
+	if (!font[mode]) { return NULL; }
+	//colors
+	Uint32 bg, fg;
+	//black text
+	if (mode == 0 || mode == 2) {
+		bg=SDL_MapRGB(font[mode]->format, 255,255,255);
+		fg=SDL_MapRGB(font[mode]->format, 0,0,0);
+	}
+	//white text (modes 1 and 3)
+	else {
+		bg=SDL_MapRGB(font[mode]->format, 0,0,0);
+		fg=SDL_MapRGB(font[mode]->format, 255,255,255);	
+	}
+	//transparent background
+	if (mode == 2 || mode == 3) {
+		SDL_SetColorKey(font[mode], SDL_TRUE, bg);
+	}
+	SDL_FillRect(font[mode], NULL, bg);
+	//load roman characters
+	for (int cc=0; cc<128; cc++) {
+		for (int jj=0; jj<8; jj++) {
+			for (int ii=0; ii<8; ii++) {
+				if (font8x8_basic[cc][jj] & 1<<ii) {
+					setPixel(font[mode],ii,jj+cc*8,fg);
+				}
+			}
+		}
+	}
+	//load hiragana
+	//TODO: you can't really use them yet, need to provide a way to access them
+	for (int cc=0; cc<96; cc++) {
+		for (int jj=0; jj<8; jj++) {
+			for (int ii=0; ii<8; ii++) {
+				if (font8x8_hiragana[cc][jj] & 1<<ii) {
+					setPixel(font[mode],ii,128*8+jj+cc*8,fg);
+				}
+			}
+		}
+	}
+	return font[mode];
+}
+
+
+//handle input -- 0 is not pressed, 1 is just pressed, 2 is held.
+//usually, you just want to check for >0 or ==1
+//everything that can press a key (keyboard keys, controller buttons) goes through a table of bindings, so all of it can be remapped with --bindings
+//the keyboard can press keys for any player, controllers belong to whichever player slot they got when they were plugged in
+const int MAX_PLAYERS = 4;
+const int STICK_DEADZONE = 13000; //TODO: this needs to be based on the stick angle and not just x/y position
+struct Inputs {
+	static const int UP = 0;
+	static const int DOWN = 1;
+	static const int LEFT = 2;
+	static const int RIGHT = 3;
+	static const int B = 4;
+	static const int A = 5;
+	static const int START = 6;
+	static const int COUNT = 7;
+	int keys[COUNT];
+	Inputs() {
+		for (int ii=0; ii<COUNT; ii++) {
+			keys[ii]=0;
+		}
+	}
+	//move on to the next frame, given a bitmask of which keys are down now
+	void update(int down) {
+		for (int ii=0; ii<COUNT; ii++) {
+			if (down & (1 << ii)) {
+				keys[ii]=keys[ii] ? 2 : 1;
+			}
+			else {
+				keys[ii]=0;
+			}
+		}
+	}
+	//every key at once: bit n is set while key n is down, bit n+8 only on the frame it was pressed
+	int mask() {
+		int packed=0;
+		for (int ii=0; ii<COUNT; ii++) {
+			if (keys[ii]) {
+				packed |= 1 << ii;
+			}
+			if (keys[ii]==1) {
+				packed |= 1 << (ii+8);
+			}
+		}
+		return packed;
+	}
+};
+//what the game sees from key() and keys()
+Inputs players[MAX_PLAYERS];
+
+//a keyboard key pressing one of a player's keys
+struct KeyBinding {
+	SDL_Keycode sym;
+	int player;
+	int key;
+	bool down;
+};
+//a controller button pressing one of that controller's player's keys
+struct ButtonBinding {
+	SDL_GameControllerButton button;
+	int key;
+};
+std::vector<KeyBinding> key_bindings;
+std::vector<ButtonBinding> button_bindings;
+
+//the default layout
+//keyboard: arrows, enter for start, and a few choices for A/B so there's one that suits any keyboard layout
+//controllers: both the bottom/left and top/right face buttons work, so either way of holding an Xbox-style pad is fine
+void defaultBindings() {
+	key_bindings.clear();
+	const KeyBinding keys[]={
+		{SDLK_UP, 0, Inputs::UP, false}, {SDLK_DOWN, 0, Inputs::DOWN, false}, {SDLK_LEFT, 0, Inputs::LEFT, false}, {SDLK_RIGHT, 0, Inputs::RIGHT, false},
+		{SDLK_RETURN, 0, Inputs::START, false}, {SDLK_RETURN2, 0, Inputs::START, false},
+		{SDLK_z, 0, Inputs::A, false}, {SDLK_s, 0, Inputs::A, false}, {SDLK_q, 0, Inputs::A, false}, {SDLK_2, 0, Inputs::A, false},
+		{SDLK_x, 0, Inputs::B, false}, {SDLK_a, 0, Inputs::B, false}, {SDLK_w, 0, Inputs::B, false}, {SDLK_1, 0, Inputs::B, false},
+	};
+	key_bindings.assign(keys, keys+sizeof(keys)/sizeof(keys[0]));
+	const ButtonBinding buttons[]={
+		{SDL_CONTROLLER_BUTTON_DPAD_UP, Inputs::UP}, {SDL_CONTROLLER_BUTTON_DPAD_DOWN, Inputs::DOWN},
+		{SDL_CONTROLLER_BUTTON_DPAD_LEFT, Inputs::LEFT}, {SDL_CONTROLLER_BUTTON_DPAD_RIGHT, Inputs::RIGHT},
+		{SDL_CONTROLLER_BUTTON_A, Inputs::A}, {SDL_CONTROLLER_BUTTON_Y, Inputs::A},
+		{SDL_CONTROLLER_BUTTON_B, Inputs::B}, {SDL_CONTROLLER_BUTTON_X, Inputs::B},
+		{SDL_CONTROLLER_BUTTON_START, Inputs::START},
+	};
+	button_bindings.assign(buttons, buttons+sizeof(buttons)/sizeof(buttons[0]));
+}
+
+//turn a key name from a bindings file into a key number, -1 if it isn't one
+int keyFromName(const std::string &name) {
+	const char *names[Inputs::COUNT]={"up", "down", "left", "right", "b", "a", "start"};
+	for (int ii=0; ii<Inputs::COUNT; ii++) {
+		if (name==names[ii]) {
+			return ii;
+		}
+	}
+	return -1;
+}
+
+//load bindings from a file, replacing the defaults for whatever the file has bindings for
+//each line is one of:
+//  key <keyboard key name> <player> <quig key>
+//  button <controller button name> <quig key>
+//returns !=0 if the file couldn't be read
+int loadBindings(const std::string &filename) {
+	std::ifstream infile(filename.c_str());
+	if (!infile) {
+		return 1;
+	}
+	std::vector<KeyBinding> new_keys;
+	std::vector<ButtonBinding> new_buttons;
+	std::string line;
+	int line_num=0;
+	while (std::getline(infile, line)) {
+		line_num++;
+		std::stringstream words(line);
+		std::string type, name, key_name;
+		if (!(words >> type) || type[0]=='#') {
+			continue;
+		}
+		if (type=="key") {
+			KeyBinding bind={SDLK_UNKNOWN, 0, -1, false};
+			words >> name >> bind.player >> key_name;
+			bind.sym=SDL_GetKeyFromName(name.c_str());
+			bind.key=keyFromName(key_name);
+			if (bind.sym != SDLK_UNKNOWN && bind.key >= 0 && bind.player >= 0 && bind.player < MAX_PLAYERS) {
+				new_keys.push_back(bind);
+				continue;
+			}
+		}
+		else if (type=="button") {
+			ButtonBinding bind;
+			words >> name >> key_name;
+			bind.button=SDL_GameControllerGetButtonFromString(name.c_str());
+			bind.key=keyFromName(key_name);
+			if (bind.button != SDL_CONTROLLER_BUTTON_INVALID && bind.key >= 0) {
+				new_buttons.push_back(bind);
+				continue;
+			}
+		}
+		QLOG(LOG_WARNING, LOG_INPUT) << "couldn't understand line " << line_num << " of '" << filename << "', skipping it";
+	}
+	if (!new_keys.empty()) {
+		key_bindings=new_keys;
+	}
+	if (!new_buttons.empty()) {
+		button_bindings=new_buttons;
+	}
+	QLOG(LOG_NOTICE, LOG_INPUT) << "loaded " << new_keys.size() << " key and " << new_buttons.size() << " button bindings from '" << filename << "'";
+	return 0;
+}
+
+//update the keyboard bindings for a key going up or down, returns true if the key was bound to anything
+bool keyEvent(SDL_Keycode sym, bool down) {
+	bool found=false;
+	for (size_t ii=0; ii<key_bindings.size(); ii++) {
+		if (key_bindings[ii].sym==sym) {
+			key_bindings[ii].down=down;
+			found=true;
+		}
+	}
+	return found;
+}
+
+//controllers, one per player slot
+struct ControllerSlot {
+	SDL_GameController *pad=NULL;
+	SDL_JoystickID id=-1;
+	int back=0; //the back/select button isn't for the game, it starts a GIF recording (0/1/2 like keys)
+};
+ControllerSlot controllers[MAX_PLAYERS];
+
+//a controller got plugged in (or was already there at startup), give it the first free player slot
+void addController(int device) {
+	if (!SDL_IsGameController(device)) {
+		const char *jsname=SDL_JoystickNameForIndex(device);
+		QLOG(LOG_WARNING, LOG_INPUT) << "no mappings for controller '" << (jsname ? jsname : "(no name)") << "'! This controller will not work with quig!";
+		return;
+	}
+	SDL_JoystickID id=SDL_JoystickGetDeviceInstanceID(device);
+	int slot=-1;
+	for (int ii=MAX_PLAYERS-1; ii>=0; ii--) {
+		if (controllers[ii].pad && controllers[ii].id==id) {
+			return;
+		}
+		if (!controllers[ii].pad) {
+			slot=ii;
+		}
+	}
+	if (slot < 0) {
+		QLOG(LOG_WARNING, LOG_INPUT) << "quig only handles " << MAX_PLAYERS << " controllers, ignoring the new one";
+		return;
+	}
+	SDL_GameController *pad=SDL_GameControllerOpen(device);
+	if (!pad) {
+		QLOG(LOG_WARNING, LOG_INPUT) << "could not open controller! " << SDL_GetError();
+		return;
+	}
+	controllers[slot].pad=pad;
+	controllers[slot].id=SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(pad));
+	controllers[slot].back=0;
+	const char *gcname=SDL_GameControllerName(pad);
+	QLOG(LOG_NOTICE, LOG_INPUT) << "controller '" << (gcname ? gcname : "(no name)") << "' connected as player " << slot;
+}
+
+//a controller got unplugged, free up its slot
+void removeController(SDL_JoystickID id) {
+	for (int ii=0; ii<MAX_PLAYERS; ii++) {
+		if (controllers[ii].pad && controllers[ii].id==id) {
+			SDL_GameControllerClose(controllers[ii].pad);
+			controllers[ii].pad=NULL;
+			controllers[ii].id=-1;
+			QLOG(LOG_NOTICE, LOG_INPUT) << "player " << ii << "'s controller was disconnected";
+		}
+	}
+}
+
+//which keys a controller has down, as a bitmask
+int readController(ControllerSlot &slot) {
+	if (!slot.pad) {
+		return 0;
+	}
+	int down=0;
+	for (size_t ii=0; ii<button_bindings.size(); ii++) {
+		if (SDL_GameControllerGetButton(slot.pad, button_bindings[ii].button)) {
+			down |= 1 << button_bindings[ii].key;
+		}
+	}
+	int jsx=SDL_GameControllerGetAxis(slot.pad, SDL_CONTROLLER_AXIS_LEFTX);
+	int jsy=SDL_GameControllerGetAxis(slot.pad, SDL_CONTROLLER_AXIS_LEFTY);
+	down |= (jsy < -STICK_DEADZONE) << Inputs::UP;
+	down |= (jsy > STICK_DEADZONE) << Inputs::DOWN;
+	down |= (jsx < -STICK_DEADZONE) << Inputs::LEFT;
+	down |= (jsx > STICK_DEADZONE) << Inputs::RIGHT;
+	bool back=SDL_GameControllerGetButton(slot.pad, SDL_CONTROLLER_BUTTON_BACK);
+	slot.back=back ? min2(slot.back+1, 2) : 0;
+	return down;
+}
+
+//read every binding and move every player on a frame
+void updateInputs() {
+	int down[MAX_PLAYERS]={0};
+	for (size_t ii=0; ii<key_bindings.size(); ii++) {
+		if (key_bindings[ii].down) {
+			down[key_bindings[ii].player] |= 1 << key_bindings[ii].key;
+		}
+	}
+	for (int ii=0; ii<MAX_PLAYERS; ii++) {
+		down[ii] |= readController(controllers[ii]);
+		players[ii].update(down[ii]);
+	}
+}
+
+//has anyone just pressed back/select on their controller?
+bool controllerBackPressed() {
+	for (int ii=0; ii<MAX_PLAYERS; ii++) {
+		if (controllers[ii].back==1) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//hashFrame -- quickly hash the visible contents of a surface
+//this isn't meant to be secure, just fast and good enough to notice a single changed pixel
+//two 32-bit FNV-style lanes (even and odd pixels) stay cheap on the Pi's 32-bit CPUs and still give us a 64-bit result
+//the unused alpha/padding bits are masked off, since blits don't promise anything about them
+Uint64 hashFrame(SDL_Surface *surf) {
+	Uint32 mask=surf->format->Rmask | surf->format->Gmask | surf->format->Bmask;
+	Uint32 h1=2166136261u, h2=0x9E3779B9u;
+	for (int yy=0; yy<surf->h; yy++) {
+		const Uint32 *row=(const Uint32*)((const Uint8*)surf->pixels+yy*surf->pitch);
+		for (int xx=0; xx+1<surf->w; xx+=2) {
+			h1=(h1 ^ (row[xx] & mask)) * 16777619u;
+			h2=(h2 ^ (row[xx+1] & mask)) * 16777619u;
+		}
+		if (surf->w & 1) {
+			h1=(h1 ^ (row[surf->w-1] & mask)) * 16777619u;
+		}
+	}
+	return ((Uint64)h1 << 32) | h2;
+}
+
+//hashBytes -- 64-bit FNV-1a over a block of memory, for checking whether a file's contents changed
+Uint64 hashBytes(const Uint8 *data, size_t size) {
+	Uint64 hash=14695981039346656037ull;
+	for (size_t ii=0; ii<size; ii++) {
+		hash=(hash ^ data[ii]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+//input recording and replay
+//--record-input logs what the game saw from key() every frame, along with the random seed, so --replay can play the session back exactly
+//keys are stored as runs (2 bits for each of the 7 keys for every player, and how many frames they stayed that way), so they only take a few KB even for a long session
+//each drawn frame's screen is hashed too (8 bytes a frame, so about 1.7MB an hour), so a replay can tell exactly when it stops matching what was recorded
+//the file is "QUIGINP2", the seed (4 bytes), then records that each start with a tag byte:
+//  'K' keys (8 bytes, 16 bits per player), frames (4 bytes) -- a run of frames with the same keys held
+//  'H' first frame (4 bytes), count (2 bytes), then count hashes (8 bytes each)
+//  'E' total frames (4 bytes) -- the end of the log
+//logs from before multiple controllers ("QUIGINP1") have 2 byte keys for just the first player, and still replay fine
+//note that this only covers what quig controls: a game that uses os.time() or os.clock() for anything besides seeding math.random won't replay properly
+struct InputLog {
+	static const int HASH_BLOCK=256; //hashes get written out in blocks this size
+	static const Uint32 REPLAY_MAX_FRAMES=1 << 26; //about 13 days at 60fps, anything past this is a damaged log
+	bool recording=false;
+	bool replaying=false;
+	Uint32 seed=0;
+	std::ofstream outfile;
+	std::vector<Uint8> pending; //data waiting to be written
+	Uint64 run_keys=0; //current run
+	Uint32 run_length=0;
+	std::vector<Uint64> hash_block;
+	Uint32 hash_block_start=0;
+	//replay data, one entry per frame
+	std::vector<Uint64> replay_keys;
+	std::vector<Uint64> replay_hashes;
+	std::vector<bool> replay_has_hash;
+	Uint32 frames=0; //frames logged or replayed so far
+	Uint32 first_mismatch=0;
+	Uint32 mismatches=0;
+
+	//pack/unpack every player's 7 key states, 14 bits per player (each player gets 16 so it's easy to read in a hex dump)
+	static Uint64 pack(const Inputs *states) {
+		Uint64 packed=0;
+		for (int pp=0; pp<MAX_PLAYERS; pp++) {
+			for (int ii=0; ii<Inputs::COUNT; ii++) {
+				packed |= (Uint64)(min2(states[pp].keys[ii], 3) & 3) << (pp*16 + ii*2);
+			}
+		}
+		return packed;
+	}
+	static void unpack(Uint64 packed, Inputs *states) {
+		for (int pp=0; pp<MAX_PLAYERS; pp++) {
+			for (int ii=0; ii<Inputs::COUNT; ii++) {
+				states[pp].keys[ii]=(packed >> (pp*16 + ii*2)) & 3;
+			}
+		}
+	}
+
+	//start writing a new log, returns false if the file can't be opened
+	bool startRecording(const std::string &name, Uint32 new_seed) {
+		outfile.open(name.c_str(), std::ios::binary);
+		if (!outfile) {
+			return false;
+		}
+		seed=new_seed;
+		recording=true;
+		const char *magic="QUIGINP2";
+		pending.insert(pending.end(), magic, magic+8);
+		putU32(pending, seed);
+		return true;
+	}
+
+	//load a log to replay, returns false if it can't be read or isn't a log
+	bool startReplay(const std::string &name) {
+		std::ifstream infile(name.c_str(), std::ios::binary);
+		if (!infile) {
+			return false;
+		}
+		std::vector<Uint8> data((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+		if (data.size() < 12 || (memcmp(data.data(), "QUIGINP1", 8) && memcmp(data.data(), "QUIGINP2", 8))) {
+			return false;
+		}
+		size_t key_size=data[7]=='1' ? 2 : 8;
+		seed=getU32(&data[8]);
+		size_t pos=12;
+		//a log from a crashed session won't have an 'E' record, we just play back whatever made it to disk
+		while (pos < data.size()) {
+			Uint8 tag=data[pos++];
+			if (tag=='K' && pos+key_size+4 <= data.size()) {
+				Uint64 keys=key_size==2 ? getU16(&data[pos]) : getU64(&data[pos]);
+				Uint32 length=getU32(&data[pos+key_size]);
+				if (length > REPLAY_MAX_FRAMES-replay_keys.size()) {
+					QLOG(LOG_WARNING, LOG_INPUT) << "input log is damaged (too many frames), replaying only the first " << replay_keys.size() << " frames";
+					break;
+				}
+				pos+=key_size+4;
+				replay_keys.insert(replay_keys.end(), length, keys);
+			}
+			else if (tag=='H' && pos+6 <= data.size()) {
+				Uint32 start=getU32(&data[pos]);
+				Uint16 count=getU16(&data[pos+4]);
+				pos+=6;
+				if (pos+count*8 > data.size()) {
+					break;
+				}
+				if ((Uint64)start+count > REPLAY_MAX_FRAMES) {
+					QLOG(LOG_WARNING, LOG_INPUT) << "input log is damaged (hashes for frame " << start << " and on), replaying only the first " << replay_keys.size() << " frames";
+					break;
+				}
+				if (replay_hashes.size() < (size_t)start+count) {
+					replay_hashes.resize(start+count, 0);
+					replay_has_hash.resize(start+count, false);
+				}
+				for (int ii=0; ii<count; ii++) {
+					replay_hashes[start+ii]=getU64(&data[pos+ii*8]);
+					replay_has_hash[start+ii]=true;
+				}
+				pos+=count*8;
+			}
+			else if (tag=='E') {
+				break;
+			}
+			else {
+				QLOG(LOG_WARNING, LOG_INPUT) << "input log is damaged, replaying only the first " << replay_keys.size() << " frames";
+				break;
+			}
+		}
+		replaying=true;
+		return true;
+	}
+
+	//(recording) log this frame's keys
+	void record(const Inputs *states) {
+		Uint64 packed=pack(states);
+		if (run_length > 0 && packed != run_keys) {
+			flushRun();
+		}
+		run_keys=packed;
+		run_length++;
+	}
+
+	//(replaying) overwrite this frame's keys with the logged ones
+	void replay(Inputs *states) {
+		if (frames < replay_keys.size()) {
+			unpack(replay_keys[frames], states);
+		}
+	}
+
+	//check the frame's hash (see hashFrame()) after step() has run, then move on to the next frame
+	//frames that were skipped while fast-forwarding don't have a hash to check
+	void endFrame(Uint64 hash, bool drawn) {
+		if (recording) {
+			if (hash_block.empty()) {
+				hash_block_start=frames;
+			}
+			hash_block.push_back(hash);
+			if (hash_block.size() >= HASH_BLOCK) {
+				flushHashes();
+				write();
+			}
+		}
+		else if (replaying && drawn && frames < replay_has_hash.size() && replay_has_hash[frames]) {
+			if (hash != replay_hashes[frames]) {
+				if (mismatches==0) {
+					first_mismatch=frames;
+					QLOG(LOG_WARNING, LOG_INPUT) << "replay diverged from the recording at frame " << frames << "!";
+				}
+				mismatches++;
+			}
+		}
+		frames++;
+	}
+
+	//do we need each frame hashed?
+	bool active() {
+		return recording || replaying;
+	}
+
+	//(replaying) has the whole log been played back?
+	bool finished() {
+		return replaying && frames >= replay_keys.size();
+	}
+
+	void flushRun() {
+		if (run_length==0) {
+			return;
+		}
+		pending.push_back('K');
+		putU64(pending, run_keys);
+		putU32(pending, run_length);
+		run_length=0;
+	}
+	void flushHashes() {
+		if (hash_block.empty()) {
+			return;
+		}
+		pending.push_back('H');
+		putU32(pending, hash_block_start);
+		putU16(pending, hash_block.size());
+		for (size_t ii=0; ii<hash_block.size(); ii++) {
+			putU64(pending, hash_block[ii]);
+		}
+		hash_block.clear();
+	}
+	void write() {
+		outfile.write((const char*)pending.data(), pending.size());
+		outfile.flush();
+		pending.clear();
+	}
+
+	//finish up the log, or report how the replay went
+	void finish() {
+		if (recording) {
+			flushRun();
+			flushHashes();
+			pending.push_back('E');
+			putU32(pending, frames);
+			write();
+			outfile.close();
+			recording=false;
+			QLOG(LOG_NOTICE, LOG_INPUT) << "recorded " << frames << " frames of input";
+		}
+		else if (replaying) {
+			replaying=false;
+			if (mismatches) {
+				QLOG(LOG_NOTICE, LOG_INPUT) << "replay of " << frames << " frames finished, " << mismatches << " frames differed from the recording (first at frame " << first_mismatch << ")";
+			}
+			else {
+				QLOG(LOG_NOTICE, LOG_INPUT) << "replay of " << frames << " frames finished, every frame matched the recording";
+			}
+		}
+	}
+};
+InputLog input_log;
+
+//framebuffer checksum traces
+//--hash-trace writes the hash of every frame to a text file, --hash-verify checks a run against one of those
+//the idea is to make a golden trace with a known good build (along with --replay so the input is the same), then verify a build with renderer changes against it
+//on the first frame that differs, the frame gets dumped as a PNG, and the golden build can dump its version of the same frame with --hash-dump
+//traces are plain text ("frame hash" on each line) so they can be compared with ordinary tools too
+struct HashTrace {
+	std::ofstream outfile;
+	bool tracing=false;
+	bool verifying=false;
+	std::vector<Uint64> golden;
+	Uint32 frames=0;
+	Uint32 first_mismatch=0;
+	Uint32 mismatches=0;
+	Sint64 dump_frame=-1; //frame to save as a PNG, if any
+
+	bool startTrace(const std::string &name) {
+		outfile.open(name.c_str());
+		if (!outfile) {
+			return false;
+		}
+		outfile << "QUIGHASH1\n";
+		tracing=true;
+		return true;
+	}
+
+	bool startVerify(const std::string &name) {
+		std::ifstream infile(name.c_str());
+		std::string line;
+		if (!infile || !std::getline(infile, line) || line!="QUIGHASH1") {
+			return false;
+		}
+		Uint32 frame;
+		std::string hash;
+		while (infile >> frame >> hash) {
+			//traces have every frame in order, anything else is damage (and a huge frame number would take up a huge amount of memory)
+			if (frame != golden.size()) {
+				QLOG(LOG_ERROR, LOG_VIDEO) << "golden trace is damaged, expected frame " << golden.size() << " but got frame " << frame;
+				return false;
+			}
+			try {
+				golden.push_back(std::stoull(hash, NULL, 16));
+			}
+			catch (std::logic_error&) {
+				return false;
+			}
+		}
+		verifying=true;
+		return true;
+	}
+
+	//save a frame to disk
+	static void dump(SDL_Surface *surf, Uint32 frame, const char *suffix) {
+		std::stringstream name;
+		name << "quig-hash-" << std::setfill('0') << std::setw(6) << frame << suffix << ".png";
+		if (!initImage()) {
+			return;
+		}
+		if (IMG_SavePNG(surf, name.str().c_str())) {
+			QLOG(LOG_ERROR, LOG_VIDEO) << "could not save '" << name.str() << "'! " << IMG_GetError();
+		}
+		else {
+			QLOG(LOG_NOTICE, LOG_VIDEO) << "saved frame " << frame << " as '" << name.str() << "'";
+		}
+	}
+
+	//do we need each frame hashed?
+	bool active() {
+		return tracing || verifying;
+	}
+
+	//write or check the hash of the frame that was just drawn
+	void endFrame(Uint64 hash, SDL_Surface *surf) {
+		if (tracing) {
+			outfile << frames << " " << std::hex << std::setfill('0') << std::setw(16) << hash << std::dec << "\n";
+		}
+		if (verifying && frames < golden.size() && hash != golden[frames]) {
+			if (mismatches==0) {
+				first_mismatch=frames;
+				QLOG(LOG_WARNING, LOG_VIDEO) << "frame " << frames << " does not match the golden trace!";
+				dump(surf, frames, "-actual");
+				QLOG(LOG_NOTICE, LOG_VIDEO) << "run the golden build with '--hash-dump " << frames << "' to get the expected frame";
+			}
+			mismatches++;
+		}
+		if (dump_frame == frames) {
+			dump(surf, frames, "");
+		}
+		frames++;
+	}
+
+	void finish() {
+		if (tracing) {
+			outfile.close();
+			tracing=false;
+			QLOG(LOG_NOTICE, LOG_VIDEO) << "wrote hashes for " << frames << " frames";
+		}
+		if (verifying) {
+			verifying=false;
+			Uint32 checked=min2(frames, golden.size());
+			if (mismatches) {
+				QLOG(LOG_NOTICE, LOG_VIDEO) << "hash verify failed, " << mismatches << " of " << checked << " frames differed (first at frame " << first_mismatch << ")";
+			}
+			else {
+				QLOG(LOG_NOTICE, LOG_VIDEO) << "hash verify passed, all " << checked << " frames matched";
+			}
+			if (frames < golden.size()) {
+				QLOG(LOG_WARNING, LOG_VIDEO) << "quig exited before the end of the golden trace (" << frames << " of " << golden.size() << " frames)";
+			}
+		}
+	}
+};
+HashTrace hash_trace;
+
+//seed math.random for recording or replay
+//any later math.randomseed() call (eg, the common math.randomseed(os.time())) reuses the same seed, so the game stays deterministic
+void seedLua(Uint32 seed) {
+	const char *code="local seed=...; local randomseed=math.randomseed; randomseed(seed); math.randomseed=function() randomseed(seed) end";
+	if (luaL_loadstring(L, code) || (lua_pushinteger(L, seed), lua_pcall(L, 1, 0, 0))) {
+		QLOG(LOG_ERROR, LOG_LUA) << "could not seed math.random! " << lua_tostring(L,-1);
+		lua_pop(L,1);
+	}
+}
+
+
+//save files
+//writefile() turns the table into bytes right away (so the game can keep changing it), then a background thread writes it out
+//the write goes to a temporary file that's flushed all the way to disk and then renamed over the old save (and the rename gets flushed too), so a crash or power cut mid-save leaves either the old save or the new one, never half of each
+//the file is "QUIGSAV1" and then one value, which is a tag byte and then:
+//  'n' number (8 byte double), 'i' integer (8 bytes), 's' string (length (4 bytes), then the bytes), 't' true, 'f' false
+//  'T' table: key/value pairs (each one a value), then 'e'
+//saves from older versions are just lines of text, readfile() still reads those as a table of strings
+const int SAVE_MAX_DEPTH=32; //values can be inside at most SAVE_MAX_DEPTH-1 tables, saveValue() and loadValue() both check this
+enum SaveStatus {
+	SAVE_NONE=0, SAVE_BUSY, SAVE_DONE, SAVE_FAILED
+};
+SDL_mutex *save_lock=NULL;
+SDL_sem *save_wake=NULL;
+SDL_Thread *save_thread=NULL;
+std::vector<Uint8> save_pending; //waiting to be written, guarded by save_lock
+std::vector<Uint8> save_latest; //the last save asked for, so readfile() sees it even if it isn't on disk yet
+bool save_queued=false; //guarded by save_lock
+bool save_quit=false; //guarded by save_lock
+SDL_atomic_t save_status;
+
+//turn a Lua value into bytes, returns false if there's something in it that can't be saved
+//visiting has the tables that are being saved right now (the ones this one is inside of), so a table that contains itself gets caught right away
+bool saveValue(lua_State *LL, int index, std::vector<Uint8> &out, int depth, std::set<const void*> &visiting) {
+	//same rule as loadValue(), or it'd save things it can't load back
+	if (depth >= SAVE_MAX_DEPTH || !lua_checkstack(LL, 3)) {
+		QLOG(LOG_ERROR, LOG_LUA) << "can't save anything nested more than " << SAVE_MAX_DEPTH-1 << " tables deep";
+		return false;
+	}
+	index=lua_absindex(LL, index);
+	switch (lua_type(LL, index)) {
+		case LUA_TNUMBER:
+			if (lua_isinteger(LL, index)) {
+				out.push_back('i');
+				putU64(out, (Uint64)lua_tointeger(LL, index));
+			}
+			else {
+				double num=lua_tonumber(LL, index);
+				Uint64 bits;
+				memcpy(&bits, &num, 8);
+				out.push_back('n');
+				putU64(out, bits);
+			}
+		return true;
+		case LUA_TBOOLEAN:
+			out.push_back(lua_toboolean(LL, index) ? 't' : 'f');
+		return true;
+		case LUA_TSTRING: {
+			size_t len;
+			const char *str=lua_tolstring(LL, index, &len);
+			out.push_back('s');
+			putU32(out, len);
+			out.insert(out.end(), str, str+len);
+		}
+		return true;
+		case LUA_TTABLE: {
+			const void *table=lua_topointer(LL, index);
+			if (!visiting.insert(table).second) {
+				QLOG(LOG_ERROR, LOG_LUA) << "can't save a table that contains itself";
+				return false;
+			}
+			out.push_back('T');
+			lua_pushnil(LL);
+			while (lua_next(LL, index)) {
+				if (!saveValue(LL, -2, out, depth+1, visiting) || !saveValue(LL, -1, out, depth+1, visiting)) {
+					lua_pop(LL, 2);
+					visiting.erase(table);
+					return false;
+				}
+				lua_pop(LL, 1);
+			}
+			visiting.erase(table);
+			out.push_back('e');
+		}
+		return true;
+	}
+	QLOG(LOG_ERROR, LOG_LUA) << "can't save a " << luaL_typename(LL, index) << ", only numbers, strings, booleans, and tables of those can be saved";
+	return false;
+}
+
+//turn bytes back into a Lua value and push it, returns false (after pushing nothing) if the data is damaged
+bool loadValue(lua_State *LL, const std::vector<Uint8> &data, size_t &pos, int depth) {
+	if (pos >= data.size() || depth >= SAVE_MAX_DEPTH || !lua_checkstack(LL, 3)) {
+		return false;
+	}
+	Uint8 tag=data[pos++];
+	if ((tag=='i' || tag=='n') && pos+8 <= data.size()) {
+		Uint64 bits=getU64(&data[pos]);
+		pos+=8;
+		if (tag=='i') {
+			lua_pushinteger(LL, (lua_Integer)bits);
+		}
+		else {
+			double num;
+			memcpy(&num, &bits, 8);
+			lua_pushnumber(LL, num);
+		}
+		return true;
+	}
+	else if (tag=='t' || tag=='f') {
+		lua_pushboolean(LL, tag=='t');
+		return true;
+	}
+	else if (tag=='s' && pos+4 <= data.size()) {
+		Uint32 len=getU32(&data[pos]);
+		pos+=4;
+		if (len > data.size()-pos) {
+			return false;
+		}
+		lua_pushlstring(LL, (const char*)&data[pos], len);
+		pos+=len;
+		return true;
+	}
+	else if (tag=='T') {
+		lua_newtable(LL);
+		while (pos < data.size() && data[pos] != 'e') {
+			if (!loadValue(LL, data, pos, depth+1)) {
+				lua_pop(LL, 1);
+				return false;
+			}
+			if (!loadValue(LL, data, pos, depth+1)) {
+				lua_pop(LL, 2);
+				return false;
+			}
+			//a nil or NaN key can't go in a table, and can't have been saved from one either
+			if (lua_isnil(LL, -2) || (lua_type(LL, -2)==LUA_TNUMBER && lua_tonumber(LL, -2) != lua_tonumber(LL, -2))) {
+				lua_pop(LL, 3);
+				return false;
+			}
+			lua_settable(LL, -3);
+		}
+		if (pos >= data.size()) {
+			lua_pop(LL, 1);
+			return false;
+		}
+		pos++;
+		return true;
+	}
+	return false;
+}
+
+//write a file so that it either fully replaces the old one or doesn't touch it at all, returns false if it couldn't
+bool writeFileAtomic(const std::string &name, const std::vector<Uint8> &data) {
+	std::string temp_name=name+".tmp";
+	FILE *outfile=fopen(temp_name.c_str(), "wb");
+	if (!outfile) {
+		return false;
+	}
+	bool ok=fwrite(data.data(), 1, data.size(), outfile)==data.size() && fflush(outfile)==0;
+	//make sure it's actually on the disk before it replaces the old save
+	#ifdef _WIN32
+	ok=ok && _commit(_fileno(outfile))==0;
+	#else
+	ok=ok && fsync(fileno(outfile))==0;
+	#endif
+	ok=(fclose(outfile)==0) && ok;
+	if (ok) {
+		#ifdef _WIN32
+		ok=MoveFileExA(temp_name.c_str(), name.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)!=0;
+		#else
+		ok=rename(temp_name.c_str(), name.c_str())==0;
+		//the rename itself isn't on the disk until the directory is
+		if (ok) {
+			size_t slash=name.rfind('/');
+			std::string dir_name=(slash==std::string::npos) ? "." : name.substr(0, slash+1);
+			int dir=open(dir_name.c_str(), O_RDONLY);
+			//some filesystems can't flush a directory at all (EINVAL), there's nothing more that can be done on those
+			ok=dir >= 0 && (fsync(dir)==0 || errno==EINVAL);
+			if (dir >= 0) {
+				close(dir);
+			}
+		}
+		#endif
+	}
+	if (!ok) {
+		remove(temp_name.c_str());
+	}
+	return ok;
+}
+
+//the save thread, writes out whatever the latest save is
+//if the game saves again before the last one finished, only the newest one gets written
+int saveThread(void *data) {
+	std::vector<Uint8> writing;
+	std::string fname=base_name+".quigsav";
+	traceThread("quig saves");
+	while (true) {
+		SDL_SemWait(save_wake);
+		SDL_LockMutex(save_lock);
+		bool queued=save_queued;
+		bool quit=save_quit;
+		writing.swap(save_pending);
+		save_queued=false;
+		SDL_UnlockMutex(save_lock);
+		if (queued) {
+			Uint64 start=SDL_GetPerformanceCounter();
+			bool ok=writeFileAtomic(fname, writing);
+			if (tracing()) {
+				traceEvent("write save", start, SDL_GetPerformanceCounter());
+			}
+			double ms=(SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency();
+			SDL_LockMutex(save_lock);
+			//a newer save is already waiting, it'll set the status when it's done
+			if (!save_queued) {
+				SDL_AtomicSet(&save_status, ok ? SAVE_DONE : SAVE_FAILED);
+			}
+			SDL_UnlockMutex(save_lock);
+			if (ok) {
+				QLOG(LOG_DEBUG, LOG_LUA) << "saved " << writing.size() << " bytes to '" << fname << "' in " << ms << "ms";
+			}
+			else {
+				QLOG(LOG_ERROR, LOG_LUA) << "could not write save file '" << fname << "'!";
+			}
+		}
+		if (quit) {
+			break;
+		}
+	}
+	return 0;
+}
+
+//hand a save off to the save thread, starting it if it isn't running yet
+//returns false if the thread couldn't start
+bool queueSave(const std::vector<Uint8> &data) {
+	if (!save_thread) {
+		save_lock=SDL_CreateMutex();
+		save_wake=SDL_CreateSemaphore(0);
+		if (save_lock && save_wake) {
+			save_thread=SDL_CreateThread(saveThread, "quig saves", NULL);
+		}
+		if (!save_thread) {
+			QLOG(LOG_ERROR, LOG_LUA) << "could not start the save thread, saving will not work! " << SDL_GetError();
+			return false;
+		}
+	}
+	SDL_LockMutex(save_lock);
+	save_pending=data;
+	save_queued=true;
+	SDL_AtomicSet(&save_status, SAVE_BUSY);
+	SDL_UnlockMutex(save_lock);
+	SDL_SemPost(save_wake);
+	return true;
+}
+
+//finish writing any save that's still queued up
+void stopSaves() {
+	if (!save_thread) {
+		return;
+	}
+	SDL_LockMutex(save_lock);
+	save_quit=true;
+	SDL_UnlockMutex(save_lock);
+	SDL_SemPost(save_wake);
+	SDL_WaitThread(save_thread, NULL);
+	save_thread=NULL;
+}
+
+//c_readfile -- load the game's save file and return what was saved in it
+//returns nil if there isn't a save or it's damaged, or for saves from older versions, a table with a string for each line
+//TODO: these should probably go somewhere other than the current directory? I think SDL has a function for files like this...
+//TODO: there should possibly be a function that allows the user to select a file -- quig handles what file is loaded, so the game doesn't just muck about with accessing random files, but that would require a way to open a file dialog across platforms
+int c_readfile(lua_State *LL) {
+	//if the last save couldn't be written, what's on disk is all there is
+	if (SDL_AtomicGet(&save_status)==SAVE_FAILED) {
+		save_latest.clear();
+	}
+	std::vector<Uint8> data=save_latest;
+	std::string fname=base_name+".quigsav";
+	//a save that's still being written is newer than what's on disk
+	if (data.empty()) {
+		std::ifstream infile(fname.c_str(), std::ios::binary);
+		if (!infile) {
+			lua_pushnil(LL);
+			return 1;
+		}
+		data.assign(std::istreambuf_iterator<char>(infile), std::istreambuf_iterator<char>());
+	}
+	if (data.size() >= 8 && !memcmp(data.data(), "QUIGSAV1", 8)) {
+		size_t pos=8;
+		if (!loadValue(LL, data, pos, 0)) {
+			QLOG(LOG_ERROR, LOG_LUA) << "save file '" << fname << "' is damaged!";
+			lua_pushnil(LL);
+		}
+		return 1;
+	}
+	//old style save, one string per line
+	lua_newtable(LL);
+	size_t start=0;
+	int line=1;
+	while (start < data.size()) {
+		size_t end=start;
+		while (end < data.size() && data[end] != '\n') {
+			end++;
+		}
+		size_t len=end-start;
+		if (len > 0 && data[end-1]=='\r') {
+			len--;
+		}
+		lua_pushlstring(LL, (const char*)data.data()+start, len);
+		lua_rawseti(LL, -2, line);
+		line++;
+		start=end+1;
+	}
+	return 1;
+}
+
+//c_writefile -- save a value (usually a table) for readfile() to load later
+//the save happens in the background, savestatus() says when it's done
+//returns false if the value can't be saved
+int c_writefile(lua_State *LL) {
+	std::vector<Uint8> data;
+	const char *magic="QUIGSAV1";
+	data.insert(data.end(), magic, magic+8);
+	std::set<const void*> visiting;
+	bool result=saveValue(LL, 1, data, 0, visiting) && queueSave(data);
+	if (result) {
+		save_latest.swap(data);
+	}
+	lua_pushboolean(LL, result);
+	return 1;
+}
+
+//c_savestatus -- check on the last writefile() from lua code
+int c_savestatus(lua_State *LL) {
+	const char *names[]={"none", "saving", "saved", "failed"};
+	lua_pushstring(LL, names[SDL_AtomicGet(&save_status)]);
+	return 1;
+}
+
+
+//snapshots and rewind
+//rewindvars() picks which globals make up the game's state, and those get snapshotted with the same format as save files (see saveValue())
+//every frame's snapshot is compared with the last one, and what changed is kept in a ring as a backward delta: the bytes that differ, XORed together and run-length encoded
+//applying a delta to a snapshot gives the one before it, so holding backspace walks back through them
+//the snapshot time is kept under REWIND_MAX_US per frame on average by taking them less often when they get expensive
+const size_t REWIND_MAX_BYTES=4*1024*1024; //total size of the deltas kept
+const double REWIND_MAX_US=1000; //how much time per frame the snapshots get, on average
+const int REWIND_MAX_INTERVAL=8; //take a snapshot at least this often
+
+//variable length numbers for the deltas, 7 bits at a time
+void putVarint(std::vector<Uint8> &out, Uint32 v) {
+	while (v >= 0x80) {
+		out.push_back((v & 0x7F) | 0x80);
+		v >>= 7;
+	}
+	out.push_back(v);
+}
+bool getVarint(const std::vector<Uint8> &in, size_t &pos, Uint32 &v) {
+	v=0;
+	for (int shift=0; shift<35 && pos < in.size(); shift+=7) {
+		Uint8 byte=in[pos++];
+		v |= (Uint32)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+struct Rewind {
+	std::vector<std::string> names; //the globals to snapshot
+	std::vector<Uint8> current; //the newest snapshot
+	std::deque<std::vector<Uint8> > deltas; //newest at the back
+	size_t bytes=0;
+	int interval=1; //frames between snapshots
+	int countdown=0;
+	double cost_us=0; //how long a snapshot takes (filtered)
+	std::vector<Uint8> scratch;
+
+	bool enabled() {
+		return !names.empty();
+	}
+	bool available() {
+		return !deltas.empty();
+	}
+
+	//register the globals to snapshot, dropping anything recorded so far
+	void setNames(const std::vector<std::string> &new_names) {
+		names=new_names;
+		current.clear();
+		deltas.clear();
+		bytes=0;
+		countdown=0;
+	}
+
+	//snapshot the registered globals, returns false if something in them can't be saved
+	//globals that are nil are just left out, restore() sets anything that's missing back to nil
+	bool snapshot(lua_State *LL, std::vector<Uint8> &out) {
+		out.clear();
+		out.push_back('T');
+		for (size_t ii=0; ii<names.size(); ii++) {
+			if (lua_getglobal(LL, names[ii].c_str())==LUA_TNIL) {
+				lua_pop(LL, 1);
+				continue;
+			}
+			out.push_back('s');
+			putU32(out, names[ii].size());
+			out.insert(out.end(), names[ii].begin(), names[ii].end());
+			std::set<const void*> visiting;
+			bool ok=saveValue(LL, -1, out, 1, visiting);
+			lua_pop(LL, 1);
+			if (!ok) {
+				return false;
+			}
+		}
+		out.push_back('e');
+		return true;
+	}
+
+	//put the globals back the way they were in a snapshot, returns false if it's damaged
+	//a global that's a table gets refilled in place, so anything else holding onto it sees the old state too
+	//tables inside of it are brand new ones though, so only the top level tables keep their identity
+	bool restore(lua_State *LL, const std::vector<Uint8> &data) {
+		size_t pos=0;
+		if (!loadValue(LL, data, pos, 0) || !lua_istable(LL, -1)) {
+			return false;
+		}
+		//anything registered that isn't in the snapshot was nil
+		for (size_t ii=0; ii<names.size(); ii++) {
+			if (lua_getfield(LL, -1, names[ii].c_str())==LUA_TNIL) {
+				lua_setglobal(LL, names[ii].c_str());
+			}
+			else {
+				lua_pop(LL, 1);
+			}
+		}
+		lua_pushnil(LL);
+		while (lua_next(LL, -2)) {
+			if (lua_type(LL, -2) != LUA_TSTRING) {
+				lua_pop(LL, 1);
+				continue;
+			}
+			const char *name=lua_tostring(LL, -2);
+			lua_getglobal(LL, name);
+			if (lua_istable(LL, -1) && lua_istable(LL, -2)) {
+				//clear out the old table, then copy the snapshot's fields into it
+				lua_pushnil(LL);
+				while (lua_next(LL, -2)) {
+					lua_pop(LL, 1);
+					lua_pushvalue(LL, -1);
+					lua_pushnil(LL);
+					lua_rawset(LL, -4);
+				}
+				lua_pushnil(LL);
+				while (lua_next(LL, -3)) {
+					lua_pushvalue(LL, -2);
+					lua_insert(LL, -2);
+					lua_rawset(LL, -4);
+				}
+				lua_pop(LL, 2);
+			}
+			else {
+				lua_pop(LL, 1);
+				lua_setglobal(LL, name);
+			}
+		}
+		lua_pop(LL, 1);
+		return true;
+	}
+
+	//make a delta that turns "from" into "to": to's length, then runs of (unchanged bytes, changed bytes, the changes XORed)
+	static void makeDelta(const std::vector<Uint8> &from, const std::vector<Uint8> &to, std::vector<Uint8> &out) {
+		out.clear();
+		size_t total=from.size() > to.size() ? from.size() : to.size();
+		putVarint(out, to.size());
+		size_t pos=0;
+		while (pos < total) {
+			size_t same=pos;
+			while (same < total && (same < from.size() ? from[same] : 0)==(same < to.size() ? to[same] : 0)) {
+				same++;
+			}
+			size_t diff=same;
+			while (diff < total && (diff < from.size() ? from[diff] : 0)!=(diff < to.size() ? to[diff] : 0)) {
+				diff++;
+			}
+			putVarint(out, same-pos);
+			putVarint(out, diff-same);
+			for (size_t ii=same; ii<diff; ii++) {
+				out.push_back((ii < from.size() ? from[ii] : 0) ^ (ii < to.size() ? to[ii] : 0));
+			}
+			pos=diff;
+		}
+	}
+	//apply a delta to "from" in place, returns false if it's damaged
+	static bool applyDelta(std::vector<Uint8> &data, const std::vector<Uint8> &delta) {
+		size_t pos=0;
+		Uint32 length, same, diff;
+		if (!getVarint(delta, pos, length)) {
+			return false;
+		}
+		if (length > data.size()) {
+			data.resize(length, 0);
+		}
+		size_t out=0;
+		while (pos < delta.size()) {
+			if (!getVarint(delta, pos, same) || !getVarint(delta, pos, diff) || pos+diff > delta.size()) {
+				return false;
+			}
+			out+=same;
+			for (Uint32 ii=0; ii<diff; ii++, out++) {
+				if (out < data.size()) {
+					data[out] ^= delta[pos+ii];
+				}
+			}
+			pos+=diff;
+		}
+		data.resize(length);
+		return true;
+	}
+
+	//(after step()) snapshot this frame if it's time to, and keep the delta back to the last one
+	void record(lua_State *LL) {
+		if (--countdown > 0) {
+			return;
+		}
+		Uint64 start=SDL_GetPerformanceCounter();
+		if (!snapshot(LL, scratch)) {
+			QLOG(LOG_ERROR, LOG_LUA) << "rewind turned off, the game's state can't be snapshotted";
+			setNames(std::vector<std::string>());
+			return;
+		}
+		if (!current.empty()) {
+			std::vector<Uint8> delta;
+			makeDelta(scratch, current, delta);
+			bytes+=delta.size();
+			deltas.push_back(std::vector<Uint8>());
+			deltas.back().swap(delta);
+			while (bytes > REWIND_MAX_BYTES && !deltas.empty()) {
+				bytes-=deltas.front().size();
+				deltas.pop_front();
+			}
+		}
+		current.swap(scratch);
+		//take snapshots less often if they're eating too much of the frame, more often once they're cheap again
+		double us=(SDL_GetPerformanceCounter()-start)*1000000.0/SDL_GetPerformanceFrequency();
+		cost_us=(cost_us==0) ? us : cost_us*0.9+us*0.1;
+		if (cost_us/interval > REWIND_MAX_US && interval < REWIND_MAX_INTERVAL) {
+			interval++;
+		}
+		else if (interval > 1 && cost_us/(interval-1) < REWIND_MAX_US/2) {
+			interval--;
+		}
+		countdown=interval;
+	}
+
+	//go back a snapshot, then (if it'll be shown) run a frame with no input and no sound to draw it and put the state back again
+	//returns !=0 if step() failed, with the error on the Lua stack like step_fn()
+	int back(lua_State *LL, bool draw) {
+		std::vector<Uint8> &delta=deltas.back();
+		if (!applyDelta(current, delta) || !restore(LL, current)) {
+			QLOG(LOG_ERROR, LOG_LUA) << "rewind data is damaged, rewind turned off";
+			setNames(names);
+			return 0;
+		}
+		bytes-=delta.size();
+		deltas.pop_back();
+		countdown=interval;
+		if (!draw) {
+			return 0;
+		}
+		for (int ii=0; ii<MAX_PLAYERS; ii++) {
+			players[ii]=Inputs();
+		}
+		sound_muted=true;
+		int result=step_fn();
+		sound_muted=false;
+		if (result) {
+			return result;
+		}
+		restore(LL, current);
+		return 0;
+	}
+};
+Rewind rewind_state;
+bool rewind_held=false; //is the rewind key down?
+
+//c_rewindvars -- set which globals make up the game's state, for rewind, snapshot() and restore()
+//rewindvars() with nothing turns rewind off
+int c_rewindvars(lua_State *LL) {
+	std::vector<std::string> names;
+	for (int ii=1; ii<=lua_gettop(LL); ii++) {
+		if (lua_type(LL, ii)==LUA_TSTRING) {
+			names.push_back(lua_tostring(LL, ii));
+		}
+	}
+	rewind_state.setNames(names);
+	return 0;
+}
+
+//c_snapshot -- get the state of the globals given to rewindvars() as a string, for restore()
+int c_snapshot(lua_State *LL) {
+	std::vector<Uint8> data;
+	if (!rewind_state.snapshot(LL, data)) {
+		lua_pushnil(LL);
+		return 1;
+	}
+	lua_pushlstring(LL, (const char*)data.data(), data.size());
+	return 1;
+}
+
+//c_restore -- put back the state from a snapshot() string
+int c_restore(lua_State *LL) {
+	size_t len=0;
+	const char *str=lua_tolstring(LL, 1, &len);
+	bool result=false;
+	if (str) {
+		std::vector<Uint8> data(str, str+len);
+		result=rewind_state.restore(LL, data);
+	}
+	lua_pushboolean(LL, result);
+	return 1;
+}
+
+
+//do_key -- check if a given key number is being pressed by a given player
+int do_key(int key, int player) {
+	if (key < 0 || key >= Inputs::COUNT || player < 0 || player >= MAX_PLAYERS) {
+		return 0;
+	}
+	return players[player].keys[key];
+}
+//c_key -- run do_key from lua code
+int c_key(lua_State *LL) {
+	int key = (int)lua_tonumber(LL, 1);
+	int player = (int)luaL_optnumber(LL, 2, 0);
+	lua_pushnumber(LL, do_key(key, player));
+	return 1;
+}
+
+//do_keys -- every key a player has down as a bitmask (see Inputs::mask())
+int do_keys(int player) {
+	if (player < 0 || player >= MAX_PLAYERS) {
+		return 0;
+	}
+	return players[player].mask();
+}
+//c_keys -- run do_keys from lua code
+int c_keys(lua_State *LL) {
+	int player = (int)luaL_optnumber(LL, 1, 0);
+	lua_pushnumber(LL, do_keys(player));
+	return 1;
+}
+
+//handle timing
+struct FrameTimer {
+	Uint32 now = 0;
+	//get how long it's been since the timer has been started
+	Uint32 getTime() {
+		return SDL_GetTicks() - now;
+	}
+	//start the timer
+	void setTime() {
+		now = SDL_GetTicks();
+	}
+};
+//handle game timing (in non-vsync modes)
+FrameTimer timer;
+
+//FramePacer -- frame timing for --low-latency, and input latency measuring for everyone
+//normally, a frame reads input, runs step(), draws, and then sleeps off the rest of the frame, so input can sit around for most of a frame before the game sees it
+//with --low-latency, we do the sleeping first instead: we keep track of how long recent frames took to run,
+//and sleep until just that long (plus a bit of safety margin) before the frame is due
+//if a frame runs long anyway, the next deadline is pushed back instead of trying to catch up, and since we plan for the slowest recent frame,
+//a spike makes us start earlier until it's been a while since the last one
+const int PACER_HISTORY=32; //how many frames' run times we keep
+const int PACER_MARGIN_US=1500; //extra time to leave for the OS not waking us up on time
+struct FramePacer {
+	Uint64 freq=0;
+	Uint64 period=0; //how long a frame is, in performance counter ticks
+	Uint64 deadline=0; //when the next frame is due to be shown, 0 if we don't know yet
+	Uint64 work_start=0;
+	Uint64 costs[PACER_HISTORY]={0}; //how long recent frames took
+	int cost_pos=0;
+	bool vsync=false; //the present itself waits for the display, so don't count that as work
+	int late_frames=0;
+	double input_latency=0; //ms from an input happening to the frame that saw it being shown, averaged
+	Uint32 input_latency_max=0;
+	//refresh is the display's rate when vsynced
+	void init(bool new_vsync, int refresh) {
+		freq=SDL_GetPerformanceFrequency();
+		vsync=new_vsync;
+		period=freq/(vsync && refresh > 0 ? refresh : FPS_RATE);
+	}
+	//sleep until it's time to start the frame
+	void wait() {
+		if (!deadline) {
+			return;
+		}
+		Uint64 predicted=0;
+		for (int ii=0; ii<PACER_HISTORY; ii++) {
+			predicted=costs[ii] > predicted ? costs[ii] : predicted;
+		}
+		predicted+=freq*PACER_MARGIN_US/1000000;
+		//if frames take nearly the whole frame anyway (or there was a spike), there's nothing to gain from starting late
+		//but still don't start before the frame's slot, that's the same 60hz cap as without low latency mode
+		if (predicted > period) {
+			predicted=period;
+		}
+		if (deadline <= predicted) {
+			return;
+		}
+		Uint64 start=deadline-predicted;
+		Uint64 now=SDL_GetPerformanceCounter();
+		//SDL_Delay is only good to about a millisecond, so sleep most of the way and spin the rest
+		if (start > now+freq/500) {
+			SDL_Delay((Uint32)((start-now)*1000/freq)-1);
+		}
+		while (SDL_GetPerformanceCounter() < start) {
+		}
+	}
+	//the frame's starting now (input's about to be read)
+	void begin() {
+		work_start=SDL_GetPerformanceCounter();
+	}
+	//about to draw to the window
+	void drawing() {
+		if (vsync) {
+			//the present waits for the display, so the best we can do is guess at what the drawing itself costs
+			costs[cost_pos]=SDL_GetPerformanceCounter()-work_start+freq/500;
+			cost_pos=(cost_pos+1)%PACER_HISTORY;
+		}
+	}
+	//the frame's been shown, input_ticks is when the oldest input it saw happened
+	void shown(bool had_input, Uint32 input_ticks) {
+		Uint64 now=SDL_GetPerformanceCounter();
+		if (!vsync) {
+			costs[cost_pos]=now-work_start;
+			cost_pos=(cost_pos+1)%PACER_HISTORY;
+		}
+		//vsync: the frame went up when the present returned, so the next one's due a refresh later
+		if (vsync || !deadline) {
+			deadline=now+period;
+		}
+		//otherwise, keep to a steady 60hz, but don't try to catch up after a long frame
+		else if (now > deadline+period) {
+			late_frames++;
+			deadline=now+period;
+		}
+		else {
+			if (now > deadline+freq/1000) {
+				late_frames++;
+			}
+			deadline+=period;
+		}
+		if (had_input) {
+			Uint32 latency=SDL_GetTicks()-input_ticks;
+			input_latency+=(latency-input_latency)*0.1;
+			input_latency_max=latency > input_latency_max ? latency : input_latency_max;
+		}
+	}
+};
+FramePacer pacer;
+
+//load the game's code from its package, precompiled if possible, pushes the chunk (or an error) like luaL_loadfile()
+//returns !=0 on failure
+int loadPakCode() {
+	std::string chunk_name="@"+arg_name;
+	const PakEntry *entry=game_pak.find("quigc");
+	if (entry) {
+		if (!luaL_loadbufferx(L, (const char*)game_pak.data(entry), entry->size, chunk_name.c_str(), "b")) {
+			return 0;
+		}
+		//bytecode from a different kind of system won't load, the source is there for this
+		QLOG(LOG_NOTICE, LOG_LUA) << "couldn't use the package's precompiled code, using the source instead (" << lua_tostring(L,-1) << ")";
+		lua_pop(L, 1);
+	}
+	entry=game_pak.find("quig");
+	if (!entry) {
+		lua_pushstring(L, "the package has no code in it");
+		return 1;
+	}
+	return luaL_loadbufferx(L, (const char*)game_pak.data(entry), entry->size, chunk_name.c_str(), "t");
+}
+
+//use the package's already decoded sprite sheet right where it's mapped, returns NULL if it isn't there or is damaged
+SDL_Surface* loadPakSprites() {
+	const PakEntry *entry=game_pak.find("sprites");
+	if (!entry) {
+		return NULL;
+	}
+	return unpackSprites(game_pak.data(entry), entry->size);
+}
+
+//optimize a surface for fast drawing to the window
+//should really muck about with this again, just in case it turns out that it's actually an issue on some platforms
+/*
+SDL_Surface* optimizeSurface(SDL_Surface *target) {
+	SDL_Surface *temp_surface = SDL_ConvertSurface(target, program_surface->format, 0);
+	return temp_surface;
+}
+*/
+
+//decoded sprite sheet cache
+//decoding the PNG (and starting up SDL_image to do it) is a good chunk of startup on slow machines, so the decoded and converted sheet gets saved
+//the cache lives in quig's pref path (see SDL_GetPrefPath()), named after a hash of the PNG's full path, and gets memory-mapped and used in place on the next run
+//the file is "QUIGSPR1", the PNG's mtime (8 bytes), size (8 bytes) and hash (8 bytes, see hashBytes()), zero padded to PAK_ALIGN, then the sheet laid out like a package's (see quigpak.h)
+//if the mtime and size match, we trust it without reading the PNG at all; if only the size matches (eg, the file got copied), the PNG's hash decides
+const char SPRITE_CACHE_MAGIC[]="QUIGSPR1";
+MappedFile sprite_cache; //stays mapped, since the sprites are used right out of it
+
+//where the cache for a given PNG goes, returns "" if there's nowhere to put it
+std::string spriteCacheName(const std::string &gfx_name) {
+	char *pref=SDL_GetPrefPath("bmdeeal", "quig");
+	if (!pref) {
+		return "";
+	}
+	std::string dir=pref;
+	SDL_free(pref);
+	//the full path, so two games that are both "game.png" in different places don't fight over one cache
+	std::string full=gfx_name;
+	#ifdef _WIN32
+	char *resolved=_fullpath(NULL, gfx_name.c_str(), 0);
+	#else
+	char *resolved=realpath(gfx_name.c_str(), NULL);
+	#endif
+	if (resolved) {
+		full=resolved;
+		free(resolved);
+	}
+	std::stringstream name;
+	name << dir << "sprites-" << std::hex << std::setfill('0') << std::setw(16) << hashBytes((const Uint8*)full.data(), full.size()) << ".cache";
+	return name.str();
+}
+
+//read a whole file, returns false if it can't
+bool readWholeFile(const std::string &name, std::vector<Uint8> &out) {
+	std::ifstream infile(name.c_str(), std::ios::binary);
+	if (!infile) {
+		return false;
+	}
+	out.assign(std::istreambuf_iterator<char>(infile), std::istreambuf_iterator<char>());
+	return true;
+}
+
+//load the sprite sheet, from the cache if we can, returns NULL if it can't be loaded at all
+SDL_Surface* loadSprites(const std::string &gfx_name) {
+	struct stat info;
+	if (stat(gfx_name.c_str(), &info)) {
+		QLOG(LOG_ERROR, LOG_VIDEO) << "'" << gfx_name << "' does not exist!";
+		return NULL;
+	}
+	Uint64 mtime=(Uint64)info.st_mtime;
+	Uint64 png_size=(Uint64)info.st_size;
+	std::vector<Uint8> png;
+	bool png_read=false;
+	std::string cache_name=sprite_cache_enabled ? spriteCacheName(gfx_name) : "";
+	if (!cache_name.empty() && sprite_cache.open(cache_name)) {
+		const Uint8 *header=sprite_cache.data;
+		bool valid=sprite_cache.size >= (size_t)PAK_ALIGN && !memcmp(header, SPRITE_CACHE_MAGIC, 8) && getU64(header+16)==png_size;
+		if (valid && getU64(header+8) != mtime) {
+			//touched, but maybe not changed
+			png_read=readWholeFile(gfx_name, png);
+			valid=png_read && hashBytes(png.data(), png.size())==getU64(header+24);
+		}
+		SDL_Surface *cached=valid ? unpackSprites(sprite_cache.data+PAK_ALIGN, sprite_cache.size-PAK_ALIGN) : NULL;
+		if (cached) {
+			QLOG(LOG_DEBUG, LOG_VIDEO) << "using cached sprites from '" << cache_name << "'";
+			return cached;
+		}
+		QLOG(LOG_DEBUG, LOG_VIDEO) << "sprite cache '" << cache_name << "' is out of date";
+		sprite_cache.close();
+	}
+	
+	//cache miss, decode it for real
+	if (!png_read && !readWholeFile(gfx_name, png)) {
+		QLOG(LOG_ERROR, LOG_VIDEO) << "could not read '" << gfx_name << "'!";
+		return NULL;
+	}
+	if (!initImage()) {
+		return NULL;
+	}
+	SDL_Surface *loaded=IMG_Load_RW(SDL_RWFromConstMem(png.data(), png.size()), 1);
+	if (!loaded) {
+		QLOG(LOG_ERROR, LOG_VIDEO) << "could not decode '" << gfx_name << "'! " << IMG_GetError();
+		return NULL;
+	}
+	SDL_Surface *converted=convertSprites(loaded);
+	if (!converted) {
+		//still usable, just slower to draw and not cacheable
+		QLOG(LOG_WARNING, LOG_VIDEO) << "could not convert sprites! " << SDL_GetError();
+		return loaded;
+	}
+	SDL_FreeSurface(loaded);
+	if (!cache_name.empty()) {
+		std::vector<Uint8> out(PAK_ALIGN, 0);
+		memcpy(out.data(), SPRITE_CACHE_MAGIC, 8);
+		std::vector<Uint8> fields;
+		putU64(fields, mtime);
+		putU64(fields, png_size);
+		putU64(fields, hashBytes(png.data(), png.size()));
+		memcpy(out.data()+8, fields.data(), fields.size());
+		packSprites(converted, out);
+		if (writeFileAtomic(cache_name, out)) {
+			QLOG(LOG_DEBUG, LOG_VIDEO) << "wrote sprite cache '" << cache_name << "'";
 		}
 		else {
-			stick_down=0;
+			QLOG(LOG_WARNING, LOG_VIDEO) << "could not write sprite cache '" << cache_name << "'";
+		}
+	}
+	return converted;
+}
+
+//startup timing, so it's easy to see where the time goes before the game starts
+//each phase gets logged as it finishes at debug level, and the whole thing gets summed up in one line at notice level
+struct StartupTimer {
+	Uint64 start=0;
+	Uint64 last=0;
+	std::stringstream phases;
+	std::stringstream tasks; //things that ran on the side (see StartupTasks)
+	bool shown=false;
+	void begin() {
+		start=last=SDL_GetPerformanceCounter();
+	}
+	static double toMs(Uint64 ticks) {
+		return ticks*1000.0/SDL_GetPerformanceFrequency();
+	}
+	//a phase just finished
+	void mark(const char *phase) {
+		Uint64 now=SDL_GetPerformanceCounter();
+		double ms=toMs(now-last);
+		QLOG(LOG_DEBUG, LOG_CORE) << phase << " took " << ms << "ms";
+		if (tracing()) {
+			traceEvent(phase, last, now);
+		}
+		if (phases.tellp() > 0) {
+			phases << ", ";
+		}
+		phases << phase << " " << std::fixed << std::setprecision(1) << ms << "ms";
+		last=now;
+	}
+	//something that ran alongside the main thread's phases finished, after taking this long
+	void task(const char *name, double ms) {
+		QLOG(LOG_DEBUG, LOG_CORE) << name << " took " << ms << "ms on the side";
+		if (tasks.tellp() > 0) {
+			tasks << ", ";
 		}
-		//stick up
-		if (jsy<-deadzone) {
-			stick_up++;
-			if (stick_up>2) {
-				stick_up=2;
+		tasks << name << " " << std::fixed << std::setprecision(1) << ms << "ms";
+	}
+	void report() {
+		QLOG(LOG_NOTICE, LOG_CORE) << "startup took " << std::fixed << std::setprecision(1) << toMs(last-start) << "ms (" << phases.str() << "; alongside: " << tasks.str() << ")";
+	}
+	//the first frame just made it to the screen
+	void firstFrame() {
+		shown=true;
+		QLOG(LOG_NOTICE, LOG_CORE) << "first frame shown " << std::fixed << std::setprecision(1) << toMs(SDL_GetPerformanceCounter()-start) << "ms after starting";
+	}
+};
+StartupTimer startup_timer;
+
+//startup tasks
+//the slow parts of starting up that don't need the main thread (compiling the code, decoding the sprites, making the fonts and recording buffers) run on a few worker threads, while the main thread sets up SDL, audio and the window
+//each worker (and the main thread, once it's done with its own part) just takes the next task nobody's started yet, so this still works out with one core or if the threads can't be made
+//the tasks only touch their own globals until wait() returns, including L, which the main thread leaves alone until then
+struct StartupTask {
+	const char *name;
+	int (*fn)(); //returns !=0 if it failed
+	int result;
+	double ms;
+};
+struct StartupTasks {
+	static const int MAX_WORKERS=3;
+	std::vector<StartupTask> tasks;
+	SDL_atomic_t next;
+	SDL_Thread *workers[MAX_WORKERS];
+	int worker_count=0;
+	bool waited=false;
+	void add(const char *name, int (*fn)()) {
+		StartupTask task={name, fn, 0, 0};
+		tasks.push_back(task);
+	}
+	//run tasks until there aren't any left to start
+	void work() {
+		while (true) {
+			int ii=SDL_AtomicAdd(&next, 1);
+			if (ii >= (int)tasks.size()) {
+				return;
+			}
+			Uint64 start=SDL_GetPerformanceCounter();
+			tasks[ii].result=tasks[ii].fn();
+			Uint64 end=SDL_GetPerformanceCounter();
+			tasks[ii].ms=StartupTimer::toMs(end-start);
+			if (tracing()) {
+				traceEvent(tasks[ii].name, start, end);
 			}
 		}
-		else {
-			stick_up=0;
+	}
+	static int workerThread(void *data) {
+		traceThread("quig startup");
+		((StartupTasks*)data)->work();
+		return 0;
+	}
+	void start() {
+		SDL_AtomicSet(&next, 0);
+		//leave a core for the main thread
+		int count=min2(max2(SDL_GetCPUCount()-1, 1), min2(MAX_WORKERS, (int)tasks.size()));
+		for (worker_count=0; worker_count<count; worker_count++) {
+			workers[worker_count]=SDL_CreateThread(workerThread, "quig startup", this);
+			if (!workers[worker_count]) {
+				QLOG(LOG_WARNING, LOG_CORE) << "could not start a startup thread, doing it on the main thread instead! " << SDL_GetError();
+				break;
+			}
 		}
-		//a
-		if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_A)) {
-			buttons[a]++;
+	}
+	//help out with whatever hasn't started yet, then wait for the rest to finish
+	void wait() {
+		if (waited) {
+			return;
 		}
-		else {
-			buttons[a]=0;
+		waited=true;
+		work();
+		for (int ii=0; ii<worker_count; ii++) {
+			SDL_WaitThread(workers[ii], NULL);
 		}
-		if (buttons[a] > 2) { buttons[a]=2; }
-		//b
-		if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_B)) {
-			buttons[b]++;
+		worker_count=0;
+		for (size_t ii=0; ii<tasks.size(); ii++) {
+			startup_timer.task(tasks[ii].name, tasks[ii].ms);
 		}
-		else {
-			buttons[b]=0;
+	}
+	//returns the result of the task with a given name
+	int result(const char *name) {
+		for (size_t ii=0; ii<tasks.size(); ii++) {
+			if (!strcmp(tasks[ii].name, name)) {
+				return tasks[ii].result;
+			}
 		}
-		if (buttons[b] > 2) { buttons[b]=2; }
-		//x
-		if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_X)) {
-			buttons[x]++;
+		return 1;
+	}
+};
+StartupTasks startup_tasks;
+
+//compile the game's code, leaving the chunk (or an error) on L's stack
+int codeTask() {
+	return game_pak.active() ? loadPakCode() : luaL_loadfile(L, arg_name.c_str());
+}
+int spritesTask() {
+	sprites=game_pak.active() ? loadPakSprites() : loadSprites(gfx_name);
+	return sprites==NULL;
+}
+int fontsTask() {
+	for (int ff=0; ff<4; ff++) {
+		if (!generateFont(ff)) {
+			return 1;
 		}
-		else {
-			buttons[x]=0;
+	}
+	return 0;
+}
+int buffersTask() {
+	program_surface=SDL_CreateRGBSurface(0, VIEW_WIDTH, VIEW_HEIGHT, 32, 0, 0, 0, 0);
+	draw_target=program_surface;
+	initRecording();
+	return program_surface==NULL;
+}
+
+//hot reloading
+//with --watch, quig keeps an eye on the game's .quig and .png, and reloads whichever one changed without restarting
+//on Linux, inotify tells us right away; everywhere else, we check the files a couple of times a second
+//the directory gets watched rather than the files, since plenty of editors save by writing a new file and renaming it over the old one
+//a change only gets picked up once things have been quiet for a moment, so we don't catch an editor halfway through saving
+const Uint32 WATCH_SETTLE_MS=100;
+const int WATCH_POLL_FRAMES=30;
+struct FileWatcher {
+	std::string code_name;
+	std::string gfx_name;
+	Uint64 code_stamp=0;
+	Uint64 gfx_stamp=0;
+	bool code_changed=false;
+	bool gfx_changed=false;
+	Uint32 last_change=0; //SDL_GetTicks() as of the latest change
+	Uint64 first_change=0; //performance counter as of the first change that hasn't been reloaded yet, to measure latency with
+	int countdown=0;
+	#ifdef __linux__
+	int fd=-1;
+	#endif
+	//the modification time and size, which is enough to notice a save even if the clock only counts seconds
+	static Uint64 stamp(const std::string &name) {
+		struct stat info;
+		if (stat(name.c_str(), &info)) {
+			return 0;
 		}
-		if (buttons[x] > 2) { buttons[x]=2; }
-		//y
-		if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_Y)) {
-			buttons[y]++;
+		return ((Uint64)info.st_mtime << 24) ^ (Uint64)info.st_size;
+	}
+	static std::string fileName(const std::string &path) {
+		size_t split=path.find_last_of("/\\");
+		return split==std::string::npos ? path : path.substr(split+1);
+	}
+	void start(const std::string &new_code, const std::string &new_gfx) {
+		code_name=new_code;
+		gfx_name=new_gfx;
+		code_stamp=stamp(code_name);
+		gfx_stamp=stamp(gfx_name);
+		#ifdef __linux__
+		size_t split=code_name.find_last_of('/');
+		std::string dir=split==std::string::npos ? "." : code_name.substr(0, split+1);
+		fd=inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd >= 0 && inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+			close(fd);
+			fd=-1;
 		}
-		else {
-			buttons[y]=0;
+		if (fd < 0) {
+			QLOG(LOG_WARNING, LOG_CORE) << "could not watch '" << dir << "' with inotify, checking the files every so often instead";
 		}
-		if (buttons[y] > 2) { buttons[y]=2; }
-		//up
-		if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_UP)) {
-			buttons[u]++;
+		#endif
+		QLOG(LOG_NOTICE, LOG_CORE) << "watching '" << code_name << "' and '" << gfx_name << "' for changes";
+	}
+	void changed(bool code) {
+		if (!code_changed && !gfx_changed) {
+			first_change=SDL_GetPerformanceCounter();
 		}
-		else {
-			buttons[u]=0;
+		(code ? code_changed : gfx_changed)=true;
+		last_change=SDL_GetTicks();
+	}
+	//look for changes, once a frame
+	void poll() {
+		#ifdef __linux__
+		if (fd >= 0) {
+			alignas(struct inotify_event) char buffer[4096];
+			ssize_t len;
+			std::string code_file=fileName(code_name);
+			std::string gfx_file=fileName(gfx_name);
+			while ((len=read(fd, buffer, sizeof(buffer))) > 0) {
+				for (char *pos=buffer; pos<buffer+len; ) {
+					const struct inotify_event *event=(const struct inotify_event*)pos;
+					if (event->len) {
+						if (code_file==event->name) {
+							changed(true);
+						}
+						else if (gfx_file==event->name) {
+							changed(false);
+						}
+					}
+					pos+=sizeof(struct inotify_event)+event->len;
+				}
+			}
+			return;
 		}
-		if (buttons[u] > 2) { buttons[u]=2; }
-		//down
-		if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_DOWN)) {
-			buttons[d]++;
+		#endif
+		if (--countdown > 0) {
+			return;
 		}
-		else {
-			buttons[d]=0;
+		countdown=WATCH_POLL_FRAMES;
+		Uint64 now=stamp(code_name);
+		if (now && now != code_stamp) {
+			code_stamp=now;
+			changed(true);
+		}
+		now=stamp(gfx_name);
+		if (now && now != gfx_stamp) {
+			gfx_stamp=now;
+			changed(false);
 		}
-		if (buttons[d] > 2) { buttons[d]=2; }
-		//left
-		if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_LEFT)) {
-			buttons[l]++;
+	}
+	//true once something's changed and it's been quiet long enough to reload it
+	bool ready() {
+		return (code_changed || gfx_changed) && SDL_GetTicks()-last_change >= WATCH_SETTLE_MS;
+	}
+};
+FileWatcher file_watcher;
+
+//reload whatever changed, keeping the old version of anything that won't load
+//the game's state stays as it was, since init() isn't run again, but the game can define reload() to fix anything up
+void hotReload() {
+	TRACE_SCOPE("reload");
+	Uint64 start=SDL_GetPerformanceCounter();
+	std::ostringstream what;
+	if (file_watcher.code_changed) {
+		if (luaL_loadfile(L, arg_name.c_str()) || lua_pcall(L, 0, 0, 0)) {
+			QLOG(LOG_ERROR, LOG_LUA) << "could not reload Lua code, the old code is still running! " << lua_tostring(L,-1);
+			lua_pop(L,1);
 		}
 		else {
-			buttons[l]=0;
+			what << "code";
+			lua_getglobal(L, "reload");
+			if (!lua_isfunction(L,-1)) {
+				lua_pop(L,1);
+			}
+			else if (lua_pcall(L, 0, 0, 0)) {
+				QLOG(LOG_ERROR, LOG_LUA) << "lua error during reload()! " << lua_tostring(L,-1);
+				lua_pop(L,1);
+			}
 		}
-		if (buttons[l] > 2) { buttons[l]=2; }
-		//right
-		if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_RIGHT)) {
-			buttons[r]++;
+	}
+	if (file_watcher.gfx_changed) {
+		//the old sheet might be using the cache's memory, which loading the new one unmaps, so it needs its own copy first
+		//without one, a failed reload would leave the old sheet pointing at nothing, so don't even try
+		SDL_Surface *copy=NULL;
+		if (sprites->flags & SDL_PREALLOC) {
+			copy=SDL_ConvertSurface(sprites, sprites->format, 0);
+			if (copy) {
+				SDL_FreeSurface(sprites);
+				sprites=copy;
+			}
 		}
-		else {
-			buttons[r]=0;
+		SDL_Surface *loaded=NULL;
+		if ((sprites->flags & SDL_PREALLOC) && !copy) {
+			QLOG(LOG_ERROR, LOG_VIDEO) << "could not copy the old graphics, skipping the reload! " << SDL_GetError();
 		}
-		if (buttons[r] > 2) { buttons[r]=2; }
-		//start
-		if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_START)) {
-			buttons[s]++;
+		else if (!(loaded=loadSprites(gfx_name))) {
+			QLOG(LOG_ERROR, LOG_VIDEO) << "could not reload graphics, keeping the old ones!";
 		}
 		else {
-			buttons[s]=0;
+			SDL_FreeSurface(sprites);
+			sprites=loaded;
+			//magic pink (#FF00FF) is transparent
+			SDL_SetColorKey(sprites, SDL_TRUE, SDL_MapRGB(sprites->format, 0xFF, 0x00, 0xFF));
+			what << (what.tellp() > 0 ? " and " : "") << "sprites";
 		}
-		if (buttons[s] > 2) { buttons[s]=2; }
-		//select (well, back I guess)
-		if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_BACK)) {
-			buttons[sel]++;
+	}
+	Uint64 end=SDL_GetPerformanceCounter();
+	if (what.tellp() > 0) {
+		QLOG(LOG_NOTICE, LOG_CORE) << "reloaded " << what.str() << " in " << std::fixed << std::setprecision(1) << StartupTimer::toMs(end-start) << "ms (" << StartupTimer::toMs(end-file_watcher.first_change) << "ms after the change)";
+	}
+	file_watcher.code_changed=false;
+	file_watcher.gfx_changed=false;
+}
+
+//init_fn() -- run the lua init() function, which gets called at the start of the game
+int init_fn() {
+	lua_getglobal(L, "init");
+	return lua_pcall(L, 0,0,0);
+}
+
+//step_fn -- run the lua step() function, which gets called every frame
+int step_fn() {
+	//every frame starts out drawing to the screen, even if the last one left a canvas as the target
+	draw_target=program_surface;
+	lua_getglobal(L, "step");
+	return lua_pcall(L, 0,0,0);
+}
+
+//canvases
+//offscreen surfaces the game can draw into once (eg, a background that never changes) and then put on the screen with a single blit() each frame
+//their pixels all come out of one block of memory that's set aside the first time a canvas is made, so making and freeing them never touches the system allocator and the total is easy to keep track of
+//canvases are numbered from 1, and 0 is the screen
+const int CANVAS_MAX=32;
+const size_t CANVAS_POOL_BYTES=4*1024*1024;
+struct CanvasPool {
+	struct Block {
+		size_t start;
+		size_t size;
+		bool used;
+	};
+	Uint32 *memory=NULL;
+	std::vector<Block> blocks; //in order, covering all of memory, sizes are in pixels
+	size_t used=0; //in pixels
+	size_t peak=0;
+	//find room for a canvas, returns NULL if there isn't any
+	Uint32* alloc(size_t pixels) {
+		if (!memory) {
+			memory=(Uint32*)SDL_malloc(CANVAS_POOL_BYTES);
+			if (!memory) {
+				return NULL;
+			}
+			Block all={0, CANVAS_POOL_BYTES/4, false};
+			blocks.push_back(all);
 		}
-		else {
-			buttons[sel]=0;
+		//rounding up keeps freed blocks from getting chopped into useless slivers
+		pixels=(pixels+15) & ~(size_t)15;
+		for (size_t ii=0; ii<blocks.size(); ii++) {
+			if (blocks[ii].used || blocks[ii].size < pixels) {
+				continue;
+			}
+			if (blocks[ii].size > pixels) {
+				Block rest={blocks[ii].start+pixels, blocks[ii].size-pixels, false};
+				blocks.insert(blocks.begin()+ii+1, rest);
+				blocks[ii].size=pixels;
+			}
+			blocks[ii].used=true;
+			used+=pixels;
+			peak=used > peak ? used : peak;
+			return memory+blocks[ii].start;
 		}
-		if (buttons[sel] > 2) { buttons[sel]=2; }
-		/*
-		//very verbose debug
-		for (int ii=0; ii<end; ii++) {
-			std::cerr<<buttons[ii];
+		return NULL;
+	}
+	//give a canvas's pixels back, merging with the free space around it
+	void release(Uint32 *pixels) {
+		size_t start=pixels-memory;
+		for (size_t ii=0; ii<blocks.size(); ii++) {
+			if (blocks[ii].start != start || !blocks[ii].used) {
+				continue;
+			}
+			blocks[ii].used=false;
+			used-=blocks[ii].size;
+			if (ii+1 < blocks.size() && !blocks[ii+1].used) {
+				blocks[ii].size+=blocks[ii+1].size;
+				blocks.erase(blocks.begin()+ii+1);
+			}
+			if (ii > 0 && !blocks[ii-1].used) {
+				blocks[ii-1].size+=blocks[ii].size;
+				blocks.erase(blocks.begin()+ii);
+			}
+			return;
 		}
-		std::cerr<<"b\n";
-		std::cerr<<"js: "<<jsx<<", " <<jsy <<"\n";
-		*/
-		//handle the dual mapping for A/B
-		button_quig_b=max2(buttons[b], buttons[x]);
-		button_quig_a=max2(buttons[a], buttons[y]);
 	}
 };
-ControllerState controllerState;
+CanvasPool canvas_pool;
+SDL_Surface *canvases[CANVAS_MAX+1]={NULL}; //canvases[0] is never used, that's the screen
+int canvas_count=0;
 
-//holds the average fps, we calculate it once a second
-double avg_fps=0.0;
+//true if the drawing functions should skip drawing right now
+//frames skipped by fast-forward don't draw to the screen, but drawing into a canvas always happens, since it's usually only done once
+bool drawSkipped() {
+	return render_skip && draw_target==program_surface;
+}
 
-//lua interpreter
-lua_State *L;
+//make a canvas, returns its number, or 0 if there's no room
+int do_newcanvas(int w, int h) {
+	if (w <= 0 || h <= 0 || w > 4096 || h > 4096) {
+		return 0;
+	}
+	int id=0;
+	for (int ii=1; ii<=CANVAS_MAX && !id; ii++) {
+		if (!canvases[ii]) {
+			id=ii;
+		}
+	}
+	if (!id) {
+		return 0;
+	}
+	Uint32 *pixels=canvas_pool.alloc((size_t)w*h);
+	if (!pixels) {
+		return 0;
+	}
+	canvases[id]=SDL_CreateRGBSurfaceWithFormatFrom(pixels, w, h, 32, w*4, program_surface->format->format);
+	if (!canvases[id]) {
+		canvas_pool.release(pixels);
+		return 0;
+	}
+	//start out entirely the transparent color, like an empty sprite sheet
+	SDL_FillRect(canvases[id], NULL, SDL_MapRGB(canvases[id]->format, 0xFF, 0x00, 0xFF));
+	canvas_count++;
+	return id;
+}
 
-//setPixel -- plot a single pixel to a surface
-//no idea why this isn't a SDL built-in in some way
-void setPixel(SDL_Surface *target, int x, int y, Uint32 color) {
-	Uint32 *px = (Uint32 *)target->pixels;
-	px[y*target->w+x]=color;
+//free a canvas, drawing goes back to the screen if it was the target
+void do_freecanvas(int id) {
+	if (id < 1 || id > CANVAS_MAX || !canvases[id]) {
+		return;
+	}
+	if (draw_target==canvases[id]) {
+		draw_target=program_surface;
+	}
+	canvas_pool.release((Uint32*)canvases[id]->pixels);
+	SDL_FreeSurface(canvases[id]);
+	canvases[id]=NULL;
+	canvas_count--;
 }
 
-//generateFont -- convert the font data
-//we call this four times to generate each variation
-//this is kinda ugly but whatever
-//TODO: we probably don't need to fill the background, having it as part of the character causes ugly scaling artifacts
-//maybe we'll just draw the rectangle as ceil(scale)
-SDL_Surface* generateFont(int mode) {
-	//font holds up to 256 chracters, but large portions are empty
-	if (mode >= 4 || mode < 0) {
+//send drawing to a canvas (or the screen, for 0), returns false if there's no such canvas
+bool do_target(int id) {
+	if (id==0) {
+		draw_target=program_surface;
+		return true;
+	}
+	if (id < 1 || id > CANVAS_MAX || !canvases[id]) {
+		return false;
+	}
+	draw_target=canvases[id];
+	return true;
+}
+
+//draw a whole canvas with its top left corner at x,y
+//the scroll shifts what's in the canvas over, wrapping around, so a canvas can be scrolled forever without redrawing it
+//if keyed, magic pink (#FF00FF) is transparent
+void do_blit(int id, int x, int y, int scroll_x, int scroll_y, bool keyed) {
+	if (id < 1 || id > CANVAS_MAX || !canvases[id] || canvases[id]==draw_target) {
+		return;
+	}
+	SDL_Surface *canvas=canvases[id];
+	int w=canvas->w;
+	int h=canvas->h;
+	int sx=((scroll_x % w)+w) % w;
+	int sy=((scroll_y % h)+h) % h;
+	SDL_SetColorKey(canvas, keyed ? SDL_TRUE : SDL_FALSE, SDL_MapRGB(canvas->format, 0xFF, 0x00, 0xFF));
+	//with a scroll, the canvas gets drawn in up to four pieces
+	for (int py=0; py<2; py++) {
+		for (int px=0; px<2; px++) {
+			SDL_Rect source, target;
+			source.x=px ? 0 : sx;
+			source.w=px ? sx : w-sx;
+			source.y=py ? 0 : sy;
+			source.h=py ? sy : h-sy;
+			if (source.w==0 || source.h==0) {
+				continue;
+			}
+			target.x=x+(px ? w-sx : 0);
+			target.y=y+(py ? h-sy : 0);
+			SDL_BlitSurface(canvas, &source, draw_target, &target);
+		}
+	}
+}
+
+//c_newcanvas -- make a canvas from lua code, returns its number, or nil if it couldn't
+//newcanvas(width, height)
+int c_newcanvas(lua_State *LL) {
+	int id=do_newcanvas((int)lua_tonumber(LL,1), (int)lua_tonumber(LL,2));
+	if (!id) {
+		lua_pushnil(LL);
+		return 1;
+	}
+	lua_pushinteger(LL, id);
+	return 1;
+}
+
+//c_freecanvas -- free a canvas from lua code
+int c_freecanvas(lua_State *LL) {
+	do_freecanvas((int)lua_tonumber(LL,1));
+	return 0;
+}
+
+//c_target -- pick where drawing goes from lua code, returns true if it worked
+//target([canvas])
+int c_target(lua_State *LL) {
+	lua_pushboolean(LL, do_target((int)luaL_optnumber(LL,1,0)));
+	return 1;
+}
+
+//c_blit -- draw a canvas from lua code
+//blit(canvas, x, y, [scroll_x], [scroll_y], [keyed])
+int c_blit(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
+	}
+	TRACE_SCOPE("blit");
+	int id=(int)lua_tonumber(LL,1);
+	int x=(int)lua_tonumber(LL,2);
+	int y=(int)lua_tonumber(LL,3);
+	int scroll_x=(int)luaL_optnumber(LL,4,0);
+	int scroll_y=(int)luaL_optnumber(LL,5,0);
+	bool keyed=lua_toboolean(LL,6);
+	do_blit(id,x,y,scroll_x,scroll_y,keyed);
+	return 0;
+}
+
+//raster effects
+//a few per-scanline tables, set from Lua, drive whole layers that get drawn natively in one call each, like the HDMA tricks on old consoles:
+//* colors: one color per line, for gradient skies and the like (gradient())
+//* scroll: a horizontal offset per line, for parallax and wavy effects (linescroll())
+//* matrix: where each line starts in the source image and how far it steps per pixel (u, v, du, dv), for rotated and scaled perspective floors (mode7())
+//the tables are indexed by line on the draw target, and the layers draw from the sprite sheet (source 0) or a canvas
+//mode7() walks the source in 16.16 fixed point, to keep floats and division out of the inner loop (about 40us a layer on an x86 desktop, it hasn't been measured on a Pi yet)
+const int RASTER_LINES=VIEW_HEIGHT;
+struct RasterTables {
+	Uint8 colors[RASTER_LINES][3];
+	int scroll[RASTER_LINES];
+	Sint32 matrix[RASTER_LINES][4]; //16.16 fixed point
+};
+RasterTables raster={};
+
+//how many numbers are in a Lua table (a flat list) or a string packed with string.pack("f", ...)
+int countNumbers(lua_State *LL, int idx) {
+	if (lua_type(LL, idx)==LUA_TSTRING) {
+		size_t len;
+		lua_tolstring(LL, idx, &len);
+		return (int)(len/sizeof(float));
+	}
+	return lua_istable(LL, idx) ? (int)lua_rawlen(LL, idx) : 0;
+}
+
+//read up to count numbers from a Lua table (a flat list) or a string packed with string.pack("f", ...) into out, returns how many there were
+int readNumbers(lua_State *LL, int idx, double *out, int count) {
+	if (lua_type(LL, idx)==LUA_TSTRING) {
+		size_t len;
+		const char *data=lua_tolstring(LL, idx, &len);
+		int have=min2((int)(len/sizeof(float)), count);
+		for (int ii=0; ii<have; ii++) {
+			float value;
+			memcpy(&value, data+ii*sizeof(float), sizeof(float));
+			out[ii]=value;
+		}
+		return have;
+	}
+	if (!lua_istable(LL, idx)) {
+		return 0;
+	}
+	int have=min2((int)lua_rawlen(LL, idx), count);
+	for (int ii=0; ii<have; ii++) {
+		lua_rawgeti(LL, idx, ii+1);
+		out[ii]=lua_tonumber(LL, -1);
+		lua_pop(LL, 1);
+	}
+	return have;
+}
+
+//get a layer's source, returns NULL if there's no such source, or it can't be read from directly
+SDL_Surface* rasterSource(int id) {
+	SDL_Surface *source=id==0 ? sprites : (id >= 1 && id <= CANVAS_MAX ? canvases[id] : NULL);
+	if (!source || source==draw_target) {
 		return NULL;
 	}
-	//make a tall surface holding everything
-	font[mode] = SDL_CreateRGBSurface(0, 8, 8*256, 32, 0, 0, 0, 0);
-	if (!font[mode]) { return NULL; }
-	//colors
-	Uint32 bg, fg;
-	//black text
-	if (mode == 0 || mode == 2) {
-		bg=SDL_MapRGB(font[mode]->format, 255,255,255);
-		fg=SDL_MapRGB(font[mode]->format, 0,0,0);
+	//the pixels get copied straight across, so they have to be laid out the same way
+	const SDL_PixelFormat *from=source->format;
+	const SDL_PixelFormat *to=draw_target->format;
+	if (from->BytesPerPixel != 4 || from->Rmask != to->Rmask || from->Gmask != to->Gmask || from->Bmask != to->Bmask) {
+		return NULL;
+	}
+	return source;
+}
+
+//clamp a range of lines to the draw target and the tables
+void rasterLines(int &y0, int &y1) {
+	y0=max2(y0, 0);
+	y1=min2(y1, min2(draw_target->h, RASTER_LINES));
+}
+
+//gradient -- fill lines y0 to y1-1 with their colors from the table
+void do_gradient(int y0, int y1) {
+	rasterLines(y0, y1);
+	for (int yy=y0; yy<y1; yy++) {
+		Uint32 color=SDL_MapRGB(draw_target->format, raster.colors[yy][0], raster.colors[yy][1], raster.colors[yy][2]);
+		Uint32 *row=(Uint32*)((Uint8*)draw_target->pixels+yy*draw_target->pitch);
+		SDL_memset4(row, color, draw_target->w);
+	}
+}
+
+//linescroll -- draw lines y0 to y1-1 from a source, starting at line source_y of it, each shifted over by its scroll offset (wrapping around)
+//if keyed, magic pink (#FF00FF) is transparent
+void do_linescroll(int id, int source_y, int y0, int y1, bool keyed) {
+	SDL_Surface *source=rasterSource(id);
+	if (!source) {
+		return;
+	}
+	int first=y0;
+	rasterLines(y0, y1);
+	int sw=source->w;
+	int sh=source->h;
+	int w=draw_target->w;
+	Uint32 rgb=source->format->Rmask | source->format->Gmask | source->format->Bmask;
+	Uint32 key=SDL_MapRGB(source->format, 0xFF, 0x00, 0xFF) & rgb;
+	for (int yy=y0; yy<y1; yy++) {
+		int sy=((source_y+yy-first) % sh+sh) % sh;
+		const Uint32 *src=(const Uint32*)((const Uint8*)source->pixels+sy*source->pitch);
+		Uint32 *row=(Uint32*)((Uint8*)draw_target->pixels+yy*draw_target->pitch);
+		int sx=((raster.scroll[yy] % sw)+sw) % sw;
+		for (int xx=0; xx<w; ) {
+			//copy a run up to the source's right edge, then wrap around
+			int run=min2(w-xx, sw-sx);
+			if (keyed) {
+				for (int ii=0; ii<run; ii++) {
+					if ((src[sx+ii] & rgb) != key) {
+						row[xx+ii]=src[sx+ii];
+					}
+				}
+			}
+			else {
+				memcpy(row+xx, src+sx, run*4);
+			}
+			xx+=run;
+			sx=0;
+		}
+	}
+}
+
+//mode7 -- draw lines y0 to y1-1 by walking through a source along each line's matrix entry
+//if wrap, the source repeats forever, otherwise anything outside it isn't drawn
+//if keyed, magic pink (#FF00FF) is transparent
+void do_mode7(int id, int y0, int y1, bool keyed, bool wrap) {
+	SDL_Surface *source=rasterSource(id);
+	if (!source) {
+		return;
+	}
+	rasterLines(y0, y1);
+	int sw=source->w;
+	int sh=source->h;
+	int w=draw_target->w;
+	//power of two sizes (like the sprite sheet) can wrap with a mask instead of a division
+	bool masked=!(sw & (sw-1)) && !(sh & (sh-1));
+	Uint32 rgb=source->format->Rmask | source->format->Gmask | source->format->Bmask;
+	Uint32 key=SDL_MapRGB(source->format, 0xFF, 0x00, 0xFF) & rgb;
+	int stride=source->pitch/4;
+	const Uint32 *pixels=(const Uint32*)source->pixels;
+	for (int yy=y0; yy<y1; yy++) {
+		Uint32 *row=(Uint32*)((Uint8*)draw_target->pixels+yy*draw_target->pitch);
+		//stepped unsigned so that running off the end wraps instead of overflowing
+		Uint32 u=(Uint32)raster.matrix[yy][0];
+		Uint32 v=(Uint32)raster.matrix[yy][1];
+		Uint32 du=(Uint32)raster.matrix[yy][2];
+		Uint32 dv=(Uint32)raster.matrix[yy][3];
+		for (int xx=0; xx<w; xx++, u+=du, v+=dv) {
+			int sx=(Sint32)u >> 16;
+			int sy=(Sint32)v >> 16;
+			if (wrap) {
+				if (masked) {
+					sx&=sw-1;
+					sy&=sh-1;
+				}
+				else {
+					sx=((sx % sw)+sw) % sw;
+					sy=((sy % sh)+sh) % sh;
+				}
+			}
+			else if (sx < 0 || sy < 0 || sx >= sw || sy >= sh) {
+				continue;
+			}
+			Uint32 px=pixels[sy*stride+sx];
+			if (!keyed || (px & rgb) != key) {
+				row[xx]=px;
+			}
+		}
+	}
+}
+
+//convert a number from Lua to fixed point with the given scale, clamped to what fits (NaN becomes 0)
+Sint32 rasterFixed(double value, double scale) {
+	value*=scale;
+	if (!(value==value)) {
+		return 0;
+	}
+	value=SDL_floor(value);
+	return value < -2147483648.0 ? SDL_MIN_SINT32 : (value > 2147483647.0 ? SDL_MAX_SINT32 : (Sint32)value);
+}
+
+//c_rastercolors -- set the color table from lua code, 3 numbers (red, green, blue) per line, starting from the top
+//rastercolors(values, [first_line])
+int c_rastercolors(lua_State *LL) {
+	double values[RASTER_LINES*3];
+	int first=max2((int)luaL_optnumber(LL,2,0), 0);
+	int have=readNumbers(LL, 1, values, RASTER_LINES*3)/3;
+	for (int ii=0; ii<have && first+ii<RASTER_LINES; ii++) {
+		for (int cc=0; cc<3; cc++) {
+			raster.colors[first+ii][cc]=(Uint8)max2(0, min2(255, (int)values[ii*3+cc]));
+		}
+	}
+	return 0;
+}
+
+//c_rasterscroll -- set the scroll table from lua code, 1 number per line
+//rasterscroll(values, [first_line])
+int c_rasterscroll(lua_State *LL) {
+	double values[RASTER_LINES];
+	int first=max2((int)luaL_optnumber(LL,2,0), 0);
+	int have=readNumbers(LL, 1, values, RASTER_LINES);
+	for (int ii=0; ii<have && first+ii<RASTER_LINES; ii++) {
+		raster.scroll[first+ii]=rasterFixed(values[ii], 1);
+	}
+	return 0;
+}
+
+//c_rastermatrix -- set the matrix table from lua code, 4 numbers (u, v, du, dv) per line
+//rastermatrix(values, [first_line])
+int c_rastermatrix(lua_State *LL) {
+	double values[RASTER_LINES*4];
+	int first=max2((int)luaL_optnumber(LL,2,0), 0);
+	int have=readNumbers(LL, 1, values, RASTER_LINES*4)/4;
+	for (int ii=0; ii<have && first+ii<RASTER_LINES; ii++) {
+		for (int cc=0; cc<4; cc++) {
+			raster.matrix[first+ii][cc]=rasterFixed(values[ii*4+cc], 65536.0);
+		}
+	}
+	return 0;
+}
+
+//c_gradient -- run do_gradient from lua code
+//gradient([y0], [y1])
+int c_gradient(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
+	}
+	TRACE_SCOPE("gradient");
+	do_gradient((int)luaL_optnumber(LL,1,0), (int)luaL_optnumber(LL,2,RASTER_LINES));
+	return 0;
+}
+
+//c_linescroll -- run do_linescroll from lua code
+//linescroll(source, source_y, [y0], [y1], [keyed])
+int c_linescroll(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
+	}
+	TRACE_SCOPE("linescroll");
+	int id=(int)lua_tonumber(LL,1);
+	int source_y=(int)lua_tonumber(LL,2);
+	int y0=(int)luaL_optnumber(LL,3,0);
+	int y1=(int)luaL_optnumber(LL,4,RASTER_LINES);
+	do_linescroll(id, source_y, y0, y1, lua_toboolean(LL,5));
+	return 0;
+}
+
+//c_mode7 -- run do_mode7 from lua code
+//mode7(source, [y0], [y1], [keyed], [wrap])
+int c_mode7(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
+	}
+	TRACE_SCOPE("mode7");
+	int id=(int)lua_tonumber(LL,1);
+	int y0=(int)luaL_optnumber(LL,2,0);
+	int y1=(int)luaL_optnumber(LL,3,RASTER_LINES);
+	bool wrap=lua_isnoneornil(LL,5) ? true : lua_toboolean(LL,5);
+	do_mode7(id, y0, y1, lua_toboolean(LL,4), wrap);
+	return 0;
+}
+
+//primitives
+//lines, circles, triangles and single pixels, drawn straight into the draw target's pixels
+//everything only walks over the part that's actually on the target, so something huge or way off the screen doesn't cost any more than what's visible
+//each one also has a batch version that takes a flat list of shapes, so drawing lots of them is one call from Lua instead of one per shape
+const int PRIM_MAX_RADIUS=1<<15;
+
+//put a pixel, if it's on the target
+inline void plot(int x, int y, Uint32 color) {
+	if (x >= 0 && y >= 0 && x < draw_target->w && y < draw_target->h) {
+		((Uint32*)((Uint8*)draw_target->pixels+y*draw_target->pitch))[x]=color;
+	}
+}
+
+//fill a horizontal run from x0 to x1 (inclusive) on line y, clipped to the target
+void hline(int x0, int x1, int y, Uint32 color) {
+	if (y < 0 || y >= draw_target->h) {
+		return;
+	}
+	x0=max2(x0, 0);
+	x1=min2(x1, draw_target->w-1);
+	if (x0 > x1) {
+		return;
+	}
+	SDL_memset4((Uint32*)((Uint8*)draw_target->pixels+y*draw_target->pitch)+x0, color, x1-x0+1);
+}
+
+Uint32 primColor(int r, int g, int b) {
+	return SDL_MapRGB(draw_target->format, r, g, b);
+}
+
+//do_pset -- set a single pixel
+void do_pset(int x, int y, Uint32 color) {
+	plot(x, y, color);
+}
+
+//do_pget -- read a single pixel, returns false if it's off the target
+bool do_pget(int x, int y, Uint8 &r, Uint8 &g, Uint8 &b) {
+	if (x < 0 || y < 0 || x >= draw_target->w || y >= draw_target->h) {
+		return false;
 	}
-	//white text (modes 1 and 3)
-	else {
-		bg=SDL_MapRGB(font[mode]->format, 0,0,0);
-		fg=SDL_MapRGB(font[mode]->format, 255,255,255);	
+	Uint32 px=((Uint32*)((Uint8*)draw_target->pixels+y*draw_target->pitch))[x];
+	SDL_GetRGB(px, draw_target->format, &r, &g, &b);
+	return true;
+}
+
+//do_line -- Bresenham line from x0,y0 to x1,y1 (both ends included)
+//it steps along whichever axis the line is longer in, and only over the part of that axis that's on the target
+//the error term is worked out directly for the first pixel that's on the target, so a line that's partly off the edge still hits exactly the same pixels as it would otherwise
+void do_line(int x0, int y0, int x1, int y1, Uint32 color) {
+	bool steep=(y1 > y0 ? y1-y0 : y0-y1) > (x1 > x0 ? x1-x0 : x0-x1);
+	//m is the long axis, n the short one
+	int m0=steep ? y0 : x0, n0=steep ? x0 : y0;
+	int m1=steep ? y1 : x1, n1=steep ? x1 : y1;
+	int m_limit=steep ? draw_target->h : draw_target->w;
+	int n_limit=steep ? draw_target->w : draw_target->h;
+	if (m0 > m1) {
+		std::swap(m0, m1);
+		std::swap(n0, n1);
 	}
-	//transparent background
-	if (mode == 2 || mode == 3) {
-		SDL_SetColorKey(font[mode], SDL_TRUE, bg);
+	int start=max2(m0, 0);
+	int end=min2(m1, m_limit-1);
+	if (start > end) {
+		return;
 	}
-	SDL_FillRect(font[mode], NULL, bg);
-	//load roman characters
-	for (int cc=0; cc<128; cc++) {
-		for (int jj=0; jj<8; jj++) {
-			for (int ii=0; ii<8; ii++) {
-				if (font8x8_basic[cc][jj] & 1<<ii) {
-					setPixel(font[mode],ii,jj+cc*8,fg);
-				}
-			}
+	//n = n0 + round((m-m0)*dn/dm), kept as a whole part and a remainder
+	Sint64 dn2=2*((Sint64)n1-n0);
+	Sint64 div=2*((Sint64)m1-m0);
+	Sint64 n=n0, rem=0;
+	if (div) {
+		Sint64 num=((Sint64)start-m0)*dn2+div/2;
+		Sint64 whole=num/div;
+		rem=num-whole*div;
+		if (rem < 0) {
+			whole--;
+			rem+=div;
 		}
+		n+=whole;
 	}
-	//load hiragana
-	//TODO: you can't really use them yet, need to provide a way to access them
-	for (int cc=0; cc<96; cc++) {
-		for (int jj=0; jj<8; jj++) {
-			for (int ii=0; ii<8; ii++) {
-				if (font8x8_hiragana[cc][jj] & 1<<ii) {
-					setPixel(font[mode],ii,128*8+jj+cc*8,fg);
-				}
+	Uint8 *pixels=(Uint8*)draw_target->pixels;
+	int pitch=draw_target->pitch;
+	for (int m=start; m<=end; m++) {
+		if (n >= 0 && n < n_limit) {
+			if (steep) {
+				((Uint32*)(pixels+m*pitch))[n]=color;
+			}
+			else {
+				((Uint32*)(pixels+n*pitch))[m]=color;
 			}
 		}
+		rem+=dn2;
+		if (rem >= div) {
+			rem-=div;
+			n++;
+		}
+		else if (rem < 0) {
+			rem+=div;
+			n--;
+		}
 	}
-	return font[mode];
 }
 
-
-//cleanup -- registered with atexit(), clean up everything at the end
-//we don't actually cleanup much right now, should really look into that, although none of the platforms we target right now have anything get left behind if we don't
-void cleanup() {
-	SDL_Quit();
+//do_circ -- midpoint circle outline, centered at x,y
+void do_circ(int x, int y, int radius, Uint32 color) {
+	if (radius < 0 || radius > PRIM_MAX_RADIUS || x+radius < 0 || y+radius < 0 || x-radius >= draw_target->w || y-radius >= draw_target->h) {
+		return;
+	}
+	int dx=radius, dy=0, err=1-radius;
+	while (dx >= dy) {
+		plot(x+dx, y+dy, color);
+		plot(x-dx, y+dy, color);
+		plot(x+dx, y-dy, color);
+		plot(x-dx, y-dy, color);
+		plot(x+dy, y+dx, color);
+		plot(x-dy, y+dx, color);
+		plot(x+dy, y-dx, color);
+		plot(x-dy, y-dx, color);
+		dy++;
+		if (err < 0) {
+			err+=2*dy+1;
+		}
+		else {
+			dx--;
+			err+=2*(dy-dx)+1;
+		}
+	}
 }
 
-//handle input -- 0 is not pressed, 1 is just pressed, 2 is held.
-//usually, you just want to check for >0 or ==1
-//this used to be the only thing holding input until controller handling was implemented, look at how small and clean it is compared to the controller code
-struct Inputs {
-	static const int UP = 0;
-	static const int DOWN = 1;
-	static const int LEFT = 2;
-	static const int RIGHT = 3;
-	static const int B = 4;
-	static const int A = 5;
-	static const int START = 6;
-	int keys[7];
-	int keys_held[7];
-	Inputs() {
-		for (int ii=0; ii<7; ii++) {
-			keys[ii]=0;
-			keys_held[ii]=0;
-		}
+//do_circfill -- filled circle, centered at x,y, as one span per line
+void do_circfill(int x, int y, int radius, Uint32 color) {
+	if (radius < 0 || radius > PRIM_MAX_RADIUS || x+radius < 0 || y+radius < 0 || x-radius >= draw_target->w || y-radius >= draw_target->h) {
+		return;
 	}
-	//check for held keys
-	void update() {
-		for (int ii=0; ii<7; ii++) {
-			if (keys[ii]) {
-				if (keys_held[ii]) { keys[ii]=2; }
-				else {keys_held[ii]=1; }
+	int dx=radius, dy=0, err=1-radius;
+	while (dx >= dy) {
+		hline(x-dx, x+dx, y+dy, color);
+		if (dy) {
+			hline(x-dx, x+dx, y-dy, color);
+		}
+		dy++;
+		if (err < 0) {
+			err+=2*dy+1;
+		}
+		else {
+			//the outer lines only need filling once, when they're done getting wider
+			if (dx >= dy) {
+				hline(x-dy+1, x+dy-1, y+dx, color);
+				hline(x-dy+1, x+dy-1, y-dx, color);
 			}
+			dx--;
+			err+=2*(dy-dx)+1;
 		}
 	}
-};
-Inputs inputs;
-Inputs inputs_final;
+}
 
+//do_tri -- triangle outline
+void do_tri(int x0, int y0, int x1, int y1, int x2, int y2, Uint32 color) {
+	do_line(x0, y0, x1, y1, color);
+	do_line(x1, y1, x2, y2, color);
+	do_line(x2, y2, x0, y0, color);
+}
 
-//put a string into a table at the top of the stack
-void strToTable(lua_State *LL, int index, const char *data) {
-	lua_pushnumber(LL, index);
-	lua_pushstring(LL, data);
-	lua_settable(LL, -3);
+//do_trifill -- filled triangle, as one span per line
+//each line gets the span between the long edge (top to bottom) and whichever short edge it's next to, only for lines on the target
+void do_trifill(int x0, int y0, int x1, int y1, int x2, int y2, Uint32 color) {
+	//sort the corners top to bottom
+	if (y1 < y0) {
+		std::swap(x0, x1);
+		std::swap(y0, y1);
+	}
+	if (y2 < y1) {
+		std::swap(x1, x2);
+		std::swap(y1, y2);
+	}
+	if (y1 < y0) {
+		std::swap(x0, x1);
+		std::swap(y0, y1);
+	}
+	if (y2 < 0 || y0 >= draw_target->h) {
+		return;
+	}
+	int top=max2(y0, 0);
+	int bottom=min2(y2, draw_target->h-1);
+	for (int yy=top; yy<=bottom; yy++) {
+		double long_x=y2==y0 ? x0 : x0+(double)(x2-x0)*(yy-y0)/(y2-y0);
+		double short_x;
+		if (yy < y1) {
+			short_x=x0+(double)(x1-x0)*(yy-y0)/(y1-y0);
+		}
+		else {
+			short_x=y2==y1 ? x1 : x1+(double)(x2-x1)*(yy-y1)/(y2-y1);
+		}
+		double left=long_x < short_x ? long_x : short_x;
+		double right=long_x < short_x ? short_x : long_x;
+		//keep huge coordinates from overflowing before hline() clips them
+		left=left < -1 ? -1 : left;
+		right=right > draw_target->w ? draw_target->w : right;
+		hline((int)SDL_floor(left+0.5), (int)SDL_floor(right+0.5), yy, color);
+	}
 }
 
-//get a string from a table
-std::string strFromTable(lua_State *LL, int index) {
-	std::string result;
-	lua_pushnumber(LL, index);
-	lua_gettable(LL, -2);
-	result=lua_tostring(LL, -1);
-	lua_pop(LL, 1);
-	return result;
+//read the color arguments that follow the shape's numbers, as a mapped color
+Uint32 luaPrimColor(lua_State *LL, int idx) {
+	return primColor((int)lua_tonumber(LL,idx), (int)lua_tonumber(LL,idx+1), (int)lua_tonumber(LL,idx+2));
 }
 
+//run a batch drawing function on every group of size numbers in a list, all in one color
+//batch(list, red, green, blue)
+void primBatch(lua_State *LL, int size, void (*draw)(const double *values, Uint32 color)) {
+	int count=countNumbers(LL, 1)/size*size;
+	if (count==0) {
+		return;
+	}
+	std::vector<double> values(count);
+	readNumbers(LL, 1, values.data(), count);
+	Uint32 color=luaPrimColor(LL, 2);
+	for (int ii=0; ii<count; ii+=size) {
+		draw(&values[ii], color);
+	}
+}
+void batchPset(const double *v, Uint32 color) {
+	do_pset((int)v[0], (int)v[1], color);
+}
+void batchLine(const double *v, Uint32 color) {
+	do_line((int)v[0], (int)v[1], (int)v[2], (int)v[3], color);
+}
+void batchCirc(const double *v, Uint32 color) {
+	do_circ((int)v[0], (int)v[1], (int)v[2], color);
+}
+void batchCircfill(const double *v, Uint32 color) {
+	do_circfill((int)v[0], (int)v[1], (int)v[2], color);
+}
+void batchTri(const double *v, Uint32 color) {
+	do_tri((int)v[0], (int)v[1], (int)v[2], (int)v[3], (int)v[4], (int)v[5], color);
+}
+void batchTrifill(const double *v, Uint32 color) {
+	do_trifill((int)v[0], (int)v[1], (int)v[2], (int)v[3], (int)v[4], (int)v[5], color);
+}
 
-//c_readfile -- this should read each line of a file and put it into a table of strings
-//TODO: handle any errors properly instead of blithely progressing
-//TODO: this probably should return another value indicating whether the read was fully successful or not
-//TODO: these should probably go somewhere other than the current directory? I think SDL has a function for files like this...
-//TODO: there should possibly be a function that allows the user to select a file -- quig handles what file is loaded, so the game doesn't just muck about with accessing random files, but that would require a way to open a file dialog across platforms
-int c_readfile(lua_State *LL) {
-	std::ifstream infile;
-	std::string line;
-	std::string fname=base_name+".quigsav";
-	infile.open(fname.c_str());
-	//populate the table
-	lua_newtable(LL);
-	for (int ii=1; std::getline(infile, line); ii++) {
-		if (QUIG_DEBUG) {
-			std::cerr << "debug: reading line " << ii << ": '" << line << "'\n";
-		}
-		strToTable(LL, ii, line.c_str());
+//c_pset -- set a pixel from lua code
+//pset(x, y, red, green, blue)
+int c_pset(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
 	}
-	infile.close();
-	return 1;
+	do_pset((int)lua_tonumber(LL,1), (int)lua_tonumber(LL,2), luaPrimColor(LL,3));
+	return 0;
 }
 
-//this should take a table and sequentially write each line to a file
-//TODO: handle any errors properly instead of blithely progressing
-//TODO: this should return true if the write was successful
-int c_writefile(lua_State *LL) {
-	bool result=false;
-	if (lua_istable(LL, 1)) {
-		std::ofstream outfile;
-		std::string fname=base_name+".quigsav";
-		std::string line;
-		outfile.open(fname.c_str());
-		for (int ii=1; ii<=luaL_len(LL, -1); ii++) {
-			line=strFromTable(LL,ii);
-			outfile << line << "\n";
-			if (QUIG_DEBUG) {
-				std::cerr << "debug: writiing line " << ii << ": '" << line << "'\n";
-			}
-		}
-		outfile.close();
+//c_pget -- read a pixel from lua code, returns red, green, blue, or nil if it's off the target
+//pget(x, y)
+int c_pget(lua_State *LL) {
+	pixels_read=true;
+	Uint8 r, g, b;
+	if (!do_pget((int)lua_tonumber(LL,1), (int)lua_tonumber(LL,2), r, g, b)) {
+		lua_pushnil(LL);
+		return 1;
 	}
-	lua_pushboolean(LL, result);
-	return 1;
+	lua_pushinteger(LL, r);
+	lua_pushinteger(LL, g);
+	lua_pushinteger(LL, b);
+	return 3;
 }
 
+//c_line -- draw a line from lua code
+//line(x0, y0, x1, y1, red, green, blue)
+int c_line(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
+	}
+	TRACE_SCOPE("line");
+	do_line((int)lua_tonumber(LL,1), (int)lua_tonumber(LL,2), (int)lua_tonumber(LL,3), (int)lua_tonumber(LL,4), luaPrimColor(LL,5));
+	return 0;
+}
 
-//do_key -- check if a given key number is being pressed
-int do_key(int key) {
-	if (key < 0 || key >= 7) {
+//c_circ/c_circfill -- draw a circle from lua code
+//circ(x, y, radius, red, green, blue)
+int c_circ(lua_State *LL) {
+	if (drawSkipped()) {
 		return 0;
 	}
-	return inputs_final.keys[key];
+	TRACE_SCOPE("circ");
+	do_circ((int)lua_tonumber(LL,1), (int)lua_tonumber(LL,2), (int)lua_tonumber(LL,3), luaPrimColor(LL,4));
+	return 0;
 }
-//c_key -- run do_key from lua code
-int c_key(lua_State *LL) {
-	int key = (int)lua_tonumber(LL, 1);
-	lua_pushnumber(LL, do_key(key));
-	return 1;
+int c_circfill(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
+	}
+	TRACE_SCOPE("circfill");
+	do_circfill((int)lua_tonumber(LL,1), (int)lua_tonumber(LL,2), (int)lua_tonumber(LL,3), luaPrimColor(LL,4));
+	return 0;
 }
 
-//handle timing
-struct FrameTimer {
-	Uint32 now = 0;
-	//get how long it's been since the timer has been started
-	Uint32 getTime() {
-		return SDL_GetTicks() - now;
+//c_tri/c_trifill -- draw a triangle from lua code
+//tri(x0, y0, x1, y1, x2, y2, red, green, blue)
+int c_tri(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
 	}
-	//start the timer
-	void setTime() {
-		now = SDL_GetTicks();
+	TRACE_SCOPE("tri");
+	do_tri((int)lua_tonumber(LL,1), (int)lua_tonumber(LL,2), (int)lua_tonumber(LL,3), (int)lua_tonumber(LL,4), (int)lua_tonumber(LL,5), (int)lua_tonumber(LL,6), luaPrimColor(LL,7));
+	return 0;
+}
+int c_trifill(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
 	}
-};
-//handle game timing (in non-vsync modes)
-FrameTimer timer;
-
-//optimize a surface for fast drawing to the window
-//should really muck about with this again, just in case it turns out that it's actually an issue on some platforms
-/*
-SDL_Surface* optimizeSurface(SDL_Surface *target) {
-	SDL_Surface *temp_surface = SDL_ConvertSurface(target, program_surface->format, 0);
-	return temp_surface;
+	TRACE_SCOPE("trifill");
+	do_trifill((int)lua_tonumber(LL,1), (int)lua_tonumber(LL,2), (int)lua_tonumber(LL,3), (int)lua_tonumber(LL,4), (int)lua_tonumber(LL,5), (int)lua_tonumber(LL,6), luaPrimColor(LL,7));
+	return 0;
 }
-*/
 
-//init_fn() -- run the lua init() function, which gets called at the start of the game
-int init_fn() {
-	lua_getglobal(L, "init");
-	return lua_pcall(L, 0,0,0);
+//batch versions, see primBatch()
+int c_psets(lua_State *LL) {
+	if (!drawSkipped()) {
+		TRACE_SCOPE("psets");
+		primBatch(LL, 2, batchPset);
+	}
+	return 0;
 }
-
-//step_fn -- run the lua step() function, which gets called every frame
-int step_fn() {
-	lua_getglobal(L, "step");
-	return lua_pcall(L, 0,0,0);
+int c_lines(lua_State *LL) {
+	if (!drawSkipped()) {
+		TRACE_SCOPE("lines");
+		primBatch(LL, 4, batchLine);
+	}
+	return 0;
+}
+int c_circs(lua_State *LL) {
+	if (!drawSkipped()) {
+		TRACE_SCOPE("circs");
+		primBatch(LL, 3, batchCirc);
+	}
+	return 0;
+}
+int c_circfills(lua_State *LL) {
+	if (!drawSkipped()) {
+		TRACE_SCOPE("circfills");
+		primBatch(LL, 3, batchCircfill);
+	}
+	return 0;
+}
+int c_tris(lua_State *LL) {
+	if (!drawSkipped()) {
+		TRACE_SCOPE("tris");
+		primBatch(LL, 6, batchTri);
+	}
+	return 0;
+}
+int c_trifills(lua_State *LL) {
+	if (!drawSkipped()) {
+		TRACE_SCOPE("trifills");
+		primBatch(LL, 6, batchTrifill);
+	}
+	return 0;
 }
 
 //do_squ -- draw a 16x16 colored square, centered at a point, which can be scaled
@@ -905,11 +5336,16 @@ void do_squ(int x, int y, double scale, int r, int g, int b) {
 	target_size.h = 16*scale;
 	target_size.x = x-(target_size.w/2);
 	target_size.y = y-(target_size.h/2);
-	SDL_FillRect(program_surface, &target_size, SDL_MapRGB(program_surface->format, r, g, b));
+	SDL_FillRect(draw_target, &target_size, SDL_MapRGB(draw_target->format, r, g, b));
 }
 
 //c_squ -- run do_squ from Lua code
+//like all of the drawing functions, this does nothing at all on frames skipped by fast-forward (unless it's drawing into a canvas)
 int c_squ(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
+	}
+	TRACE_SCOPE("squ");
 	int x = (int)lua_tonumber(LL,1);
 	int y = (int)lua_tonumber(LL,2);
 	double scale = lua_tonumber(LL,3);
@@ -927,11 +5363,15 @@ void do_rect(int x, int y, int w, int h, int r, int g, int b) {
 	target_size.h = h;
 	target_size.x = x;
 	target_size.y = y;
-	SDL_FillRect(program_surface, &target_size, SDL_MapRGB(program_surface->format, r, g, b));
+	SDL_FillRect(draw_target, &target_size, SDL_MapRGB(draw_target->format, r, g, b));
 }
 
 //c_rect -- run do_rect from lua code
 int c_rect(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
+	}
+	TRACE_SCOPE("rect");
 	int x=(int)lua_tonumber(LL,1);
 	int y=(int)lua_tonumber(LL,2);
 	int w=(int)lua_tonumber(LL,3);
@@ -969,22 +5409,26 @@ void do_spr(int x, int y, double scale, int sx, int sy) {
 	//we also only bother with this for sprites on the screen edge
 	//this might be slower by a bit
 	SDL_Surface *scale_temp = NULL;
-	if (target_size.x < 0 ||target_size.x+target_size.w > VIEW_WIDTH || target_size.y < 0 ||target_size.y+target_size.h > VIEW_HEIGHT) {
+	if (target_size.x < 0 ||target_size.x+target_size.w > draw_target->w || target_size.y < 0 ||target_size.y+target_size.h > draw_target->h) {
 		scale_temp=SDL_CreateRGBSurface(0, temp_size.w, temp_size.h, 32, 0,0,0,0);
 	}
 	if (scale_temp) {
 		SDL_FillRect(scale_temp, &temp_size, SDL_MapRGB(scale_temp->format, 0xFF, 0x00, 0xFF));
 		SDL_BlitScaled(sprites, &source_size, scale_temp, &temp_size);
 		SDL_SetColorKey(scale_temp, SDL_TRUE, SDL_MapRGB(scale_temp->format, 0xFF, 0x00, 0xFF));
-		SDL_BlitSurface(scale_temp, &temp_size, program_surface, &target_size);
+		SDL_BlitSurface(scale_temp, &temp_size, draw_target, &target_size);
 		SDL_FreeSurface(scale_temp);
 	}
 	else {
-		SDL_BlitScaled(sprites, &source_size, program_surface, &target_size);
+		SDL_BlitScaled(sprites, &source_size, draw_target, &target_size);
 	}
 }
 //c_spr -- run do_spr from Lua code
 int c_spr(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
+	}
+	TRACE_SCOPE("spr");
 	int x = (int)lua_tonumber(LL,1);
 	int y = (int)lua_tonumber(LL,2);
 	double scale = lua_tonumber(LL,3);
@@ -998,8 +5442,11 @@ int c_spr(lua_State *LL) {
 //do_text -- show some text
 //TODO: make sure the background doesn't have gaps on modes with a background color
 //TODO: some kind of function for displaying hiragana, or at least a function that generates a string that you can use here
-void do_text(const char *str, int x, int y, double scale, int mode) {
+void do_text(const char *str, int x, int y, double scale, int mode, SDL_Surface *dest) {
 	int x_offset=0, y_offset=0;
+	if (!dest) {
+		dest=draw_target;
+	}
 	if (mode < 0 || mode >= 4) { return; } //don't draw anything with invalid modes
 	//draw the text, character by character
 	for (int ii=0; str[ii]!='\0'; ii++) {
@@ -1035,11 +5482,15 @@ void do_text(const char *str, int x, int y, double scale, int mode) {
 		}
 		*/
 		//draw
-		SDL_BlitScaled(font[mode], &font_rect, program_surface, &target_rect);
+		SDL_BlitScaled(font[mode], &font_rect, dest, &target_rect);
 	}
 }
 //c_text -- run do_text from lua code
 int c_text(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
+	}
+	TRACE_SCOPE("text");
 	const char *str = lua_tostring(LL,1);
 	int x=(int)lua_tonumber(LL,2);
 	int y=(int)lua_tonumber(LL,3);
@@ -1082,11 +5533,15 @@ int c_squcol(lua_State *LL) {
 
 //do_cls -- clear the screen
 void do_cls(int r, int g, int b) {
-	SDL_FillRect(program_surface, NULL, SDL_MapRGB(program_surface->format, r, g, b));
+	SDL_FillRect(draw_target, NULL, SDL_MapRGB(draw_target->format, r, g, b));
 }
 
 //c_cls -- call do_cls from lua code
 int c_cls(lua_State *LL) {
+	if (drawSkipped()) {
+		return 0;
+	}
+	TRACE_SCOPE("cls");
 	int r=(int)lua_tonumber(LL,1);
 	int g=(int)lua_tonumber(LL,2);
 	int b=(int)lua_tonumber(LL,3);
@@ -1094,82 +5549,283 @@ int c_cls(lua_State *LL) {
 	return 0;
 }
 
+//setStat -- set a number in the table on top of the stack
+void setStat(lua_State *LL, const char *name, double value) {
+	lua_pushnumber(LL, value);
+	lua_setfield(LL, -2, name);
+}
+
+//c_getstats -- get a table of quig's performance stats from lua code
+int c_getstats(lua_State *LL) {
+	lua_newtable(LL);
+	setStat(LL, "fps", avg_fps);
+	setStat(LL, "frame", frame_number);
+	setStat(LL, "input_latency", pacer.input_latency);
+	setStat(LL, "input_latency_max", pacer.input_latency_max);
+	setStat(LL, "late_frames", pacer.late_frames);
+	if (rewind_state.enabled()) {
+		setStat(LL, "rewind_frames", rewind_state.deltas.size()*rewind_state.interval);
+		setStat(LL, "rewind_bytes", rewind_state.bytes);
+		setStat(LL, "rewind_time", rewind_state.cost_us);
+		setStat(LL, "rewind_interval", rewind_state.interval);
+	}
+	if (canvas_pool.memory) {
+		setStat(LL, "canvases", canvas_count);
+		setStat(LL, "canvas_bytes", canvas_pool.used*4);
+		setStat(LL, "canvas_peak", canvas_pool.peak*4);
+		setStat(LL, "canvas_pool", CANVAS_POOL_BYTES);
+	}
+	if (sound_active && !offline_audio) {
+		setStat(LL, "audio_fill", SDL_AtomicGet(&audio_fill_us)/1000.0);
+		setStat(LL, "audio_latency", SDL_AtomicGet(&audio_latency_us)/1000.0);
+		setStat(LL, "audio_rate", SDL_AtomicGet(&audio_rate_ppm));
+		setStat(LL, "audio_buffer", audio_device_samples);
+		setStat(LL, "audio_underruns", SDL_AtomicGet(&audio_underruns));
+		setStat(LL, "music_underruns", SDL_AtomicGet(&music_underruns));
+		setStat(LL, "mixer_time", SDL_AtomicGet(&mixer_us));
+		setStat(LL, "mixer_time_max", SDL_AtomicGet(&mixer_max_us));
+		lua_newtable(LL);
+		for (int ii=0; ii<AUDIO_FILL_BUCKETS; ii++) {
+			lua_pushinteger(LL, SDL_AtomicGet(&audio_fill_hist[ii]));
+			lua_rawseti(LL, -2, ii+1);
+		}
+		lua_setfield(LL, -2, "audio_fill_histogram");
+	}
+	return 1;
+}
+
 //c_getfps -- get the value of avg_fps from lua code
 int c_getfps(lua_State *LL) {
 	lua_pushnumber(LL, avg_fps);
 	return 1;
 }
 
+//c_tone -- play a tone on a synthesizer voice from lua code
+//tone(voice, frequency, volume, [wave], [frames], [decay])
+int c_tone(lua_State *LL) {
+	int voice=(int)lua_tonumber(LL,1);
+	double freq=lua_tonumber(LL,2);
+	int volume=(int)lua_tonumber(LL,3);
+	int wave=(int)luaL_optnumber(LL,4,4);
+	int frames=(int)luaL_optnumber(LL,5,0);
+	int decay=(int)luaL_optnumber(LL,6,0);
+	if (voice >= 0 && voice < SYNTH_VOICES && wave != WAVE_NOISE) {
+		SoundCommand cmd={0, SOUND_TONE, voice, wave, freq, volume, frames, decay, false, false};
+		queueSound(cmd);
+	}
+	return 0;
+}
 
-/*
+//c_noise -- play noise on a synthesizer voice from lua code
+//noise(voice, rate, volume, [frames], [decay], [short])
+int c_noise(lua_State *LL) {
+	int voice=(int)lua_tonumber(LL,1);
+	double rate=lua_tonumber(LL,2);
+	int volume=(int)lua_tonumber(LL,3);
+	int frames=(int)luaL_optnumber(LL,4,0);
+	int decay=(int)luaL_optnumber(LL,5,0);
+	bool short_noise=lua_toboolean(LL,6);
+	if (voice >= 0 && voice < SYNTH_VOICES) {
+		SoundCommand cmd={0, SOUND_TONE, voice, WAVE_NOISE, rate, volume, frames, decay, short_noise, false};
+		queueSound(cmd);
+	}
+	return 0;
+}
+
+//c_stopvoice -- silence a synthesizer voice from lua code
+int c_stopvoice(lua_State *LL) {
+	int voice=(int)lua_tonumber(LL,1);
+	if (voice >= 0 && voice < SYNTH_VOICES) {
+		SoundCommand cmd={0, SOUND_STOPVOICE, voice, 0, 0, 0, 0, 0, false, false};
+		queueSound(cmd);
+	}
+	return 0;
+}
+
+
+//do_playsound -- start a sample playing on a channel
+void do_playsound(int sound, int channel, int volume, bool loop) {
+	if (sound >= 0 && sound < SOUND_MAX && channel >= 0 && channel < NUM_CHANNELS && sounds[sound].length) {
+		SoundCommand cmd={0, SOUND_PLAYSAMPLE, channel, sound, 0, volume, 0, 0, false, loop};
+		queueSound(cmd);
+	}
+}
+
+//c_playsound -- play a sound file once from lua code
 int c_playsound(lua_State *LL) {
 	int sound=(int)lua_tonumber(LL,1);
 	int channel=(int)lua_tonumber(LL,2);
-	#ifndef QUIG_NOSOUND
-	if (sound<AUDIO_MAX && sound>=0 && channel<NUM_CHANNELS) {
-		samples[sound].play(channel);
+	int volume=SOUND_MAX_VOLUME;
+	if (lua_gettop(LL) >= 3) {
+		volume=(int)lua_tonumber(LL,3);
 	}
-	#endif
+	do_playsound(sound, channel, volume, false);
 	return 0;
 }
+
+//c_loopsound -- play a sound file over and over from lua code
 int c_loopsound(lua_State *LL) {
 	int sound=(int)lua_tonumber(LL,1);
 	int channel=(int)lua_tonumber(LL,2);
-	#ifndef QUIG_NOSOUND
-	if (sound<AUDIO_MAX && sound>=0 && channel<NUM_CHANNELS) {
-		samples[sound].playloop(channel);
+	int volume=SOUND_MAX_VOLUME;
+	if (lua_gettop(LL) >= 3) {
+		volume=(int)lua_tonumber(LL,3);
 	}
-	#endif
+	do_playsound(sound, channel, volume, true);
 	return 0;
 }
 
+//c_stopsound -- stop a sample channel from lua code
 int c_stopsound(lua_State *LL) {
 	int channel=(int)lua_tonumber(LL,1);
-	#ifndef QUIG_NOSOUND
-	Mix_HaltChannel(channel);
-	#endif
+	if (channel >= 0 && channel < NUM_CHANNELS) {
+		SoundCommand cmd={0, SOUND_STOPSAMPLE, channel, 0, 0, 0, 0, 0, false, false};
+		queueSound(cmd);
+	}
 	return 0;
 }
 
-//c_playsong -- play a music file from lua code
+//do_playsong -- start streaming a song, looping or not
+void do_playsong(int song, int volume, bool loop) {
+	if (song >= 0 && song < SONG_MAX && !sound_muted) {
+		SoundCommand cmd={0, SOUND_PLAYSONG, 0, song, 0, volume, requestSong(song, loop), 0, false, loop};
+		queueSound(cmd);
+	}
+}
+
+//c_playsong -- play a music file once from lua code
 int c_playsong(lua_State *LL) {
 	int song=(int)lua_tonumber(LL,1);
-	#ifndef QUIG_NOSOUND
-	if (song<AUDIO_MAX && song>=0) {
-		songs[song].play();
+	int volume=SOUND_MAX_VOLUME;
+	if (lua_gettop(LL) >= 2) {
+		volume=(int)lua_tonumber(LL,2);
+	}
+	do_playsong(song, volume, false);
+	return 0;
+}
+
+//c_loopsong -- loop a music file from lua code
+int c_loopsong(lua_State *LL) {
+	int song=(int)lua_tonumber(LL,1);
+	int volume=SOUND_MAX_VOLUME;
+	if (lua_gettop(LL) >= 2) {
+		volume=(int)lua_tonumber(LL,2);
+	}
+	do_playsong(song, volume, true);
+	return 0;
+}
+
+//c_stopsong -- stop music from playing from lua code
+int c_stopsong(lua_State *LL) {
+	if (sound_muted) {
+		return 0;
+	}
+	SoundCommand cmd={0, SOUND_PLAYSONG, 0, -1, 0, 0, requestSong(-1, false), 0, false, false};
+	queueSound(cmd);
+	return 0;
+}
+
+//initWindow -- create the window, and whatever we need to draw the final screen to it
+//returns !=0 if that failed (after telling the user)
+int initWindow() {
+	Uint32 full=0;
+	if (fullscreen) {
+		full=SDL_WINDOW_FULLSCREEN_DESKTOP;
+	}
+	window = SDL_CreateWindow("quig simple game system", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_width, window_height, SDL_WINDOW_SHOWN | full);
+	if (window == NULL) {
+		QLOG(LOG_FATAL, LOG_VIDEO) << "could not create window! " << SDL_GetError();
+		return 1;
+	}
+	
+	//software final blits
+	//TODO: really, these should be unified and all use the renderer API
+	//in fact, all of quig should, but eh
+	if (display_mode==DisplayMode::soft) {
+		QLOG(LOG_NOTICE, LOG_VIDEO) << "using software driven window";
+		window_surface = SDL_GetWindowSurface(window);
+		SDL_FillRect(window_surface, NULL, SDL_MapRGB(window_surface->format, 0xFF, 0xFF, 0xFF));
+	}
+	//hardware accelerated final blits
+	else {
+		QLOG(LOG_NOTICE, LOG_VIDEO) << "using hardware drawn window";
+		Uint32 vsync_on=0;
+		if (display_mode==DisplayMode::hard_vsync) {
+			QLOG(LOG_NOTICE, LOG_VIDEO) << "vsync enabled";
+			vsync_on = SDL_RENDERER_PRESENTVSYNC;
+		}
+		else {
+			QLOG(LOG_NOTICE, LOG_VIDEO) << "vsync disabled";
+		}
+		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | vsync_on);
+		//TODO: should we just go and attempt to try software mode? I think just failing out is the right thing, most machines should not be using software mode unless something is wrong
+		if (renderer == NULL) {
+			QLOG(LOG_FATAL, LOG_VIDEO) << "could not create renderer!";
+			SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", "Fatal error:\nCould not create renderer!", window);
+			return 1;
+		}
 	}
-	#endif
 	return 0;
 }
 
-//c_loopsong -- loop a music file from lua code
-int c_loopsong(lua_State *LL) {
-	int song=(int)lua_tonumber(LL,1);
-	#ifndef QUIG_NOSOUND
-	if (song<AUDIO_MAX && song>=0) {
-		songs[song].playloop();
-	}
-	#endif
-	return 0;
-}
+//the F3 stats overlay
+//it's drawn over a copy of the screen, so it never ends up in screenshots, recordings or frame hashes
+bool show_stats=false;
+SDL_Surface *stats_surface=NULL;
 
-//c_stopsong -- stop music from playing from lua code
-//TODO: there's a weird thing where SDL_Mixer will stutter when replaying a song after this -- really would like to know how to fix it
-int c_stopsong(lua_State *LL) {
-	#ifndef QUIG_NOSOUND
-	//Mix_RewindMusic();
-	Mix_HaltMusic();
-	#endif
-	return 0;
+//draw the overlay, returns the surface to show
+SDL_Surface* drawStats() {
+	if (!stats_surface) {
+		stats_surface=SDL_CreateRGBSurface(0, VIEW_WIDTH, VIEW_HEIGHT, 32, 0, 0, 0, 0);
+		if (!stats_surface) {
+			return program_surface;
+		}
+	}
+	SDL_BlitSurface(program_surface, NULL, stats_surface, NULL);
+	std::stringstream lines;
+	lines << std::fixed << std::setprecision(1);
+	lines << "fps " << avg_fps << " frame " << frame_number << "\n";
+	lines << "input " << pacer.input_latency << "ms max " << pacer.input_latency_max << " late " << pacer.late_frames << "\n";
+	if (rewind_state.enabled()) {
+		lines << "rewind " << rewind_state.deltas.size()*rewind_state.interval << "f " << rewind_state.bytes/1024 << "k " << rewind_state.cost_us << "us/" << rewind_state.interval << "\n";
+	}
+	if (canvas_pool.memory) {
+		lines << "canvas " << canvas_count << " " << canvas_pool.used*4/1024 << "k/" << CANVAS_POOL_BYTES/1024 << "k peak " << canvas_pool.peak*4/1024 << "k\n";
+	}
+	if (sound_active && !offline_audio) {
+		lines << "fill " << SDL_AtomicGet(&audio_fill_us)/1000.0 << "ms lat " << SDL_AtomicGet(&audio_latency_us)/1000.0 << "ms\n";
+		lines << "rate " << SDL_AtomicGet(&audio_rate_ppm) << "ppm buf " << audio_device_samples << "\n";
+		lines << "under " << SDL_AtomicGet(&audio_underruns) << " music " << SDL_AtomicGet(&music_underruns) << "\n";
+		lines << "mix " << SDL_AtomicGet(&mixer_us) << "us max " << SDL_AtomicGet(&mixer_max_us) << "us\n";
+		//fill histogram, as percentages
+		int total=0;
+		for (int ii=0; ii<AUDIO_FILL_BUCKETS; ii++) {
+			total+=SDL_AtomicGet(&audio_fill_hist[ii]);
+		}
+		lines << "hist";
+		for (int ii=0; ii<AUDIO_FILL_BUCKETS; ii++) {
+			lines << " " << (total ? SDL_AtomicGet(&audio_fill_hist[ii])*100/total : 0);
+		}
+		lines << "\n";
+	}
+	do_text(lines.str().c_str(), 0, 0, 1, 1, stats_surface);
+	return stats_surface;
 }
-*/
 
 //updateScreen -- draw the final screen every frame
 //TODO: maintain aspect ratio in software mode
 void updateScreen() {
+	//nothing to draw to
+	if (headless) {
+		return;
+	}
+	SDL_Surface *shown=program_surface;
+	if (show_stats) {
+		shown=drawStats();
+	}
 	//just blit the surface to the window in software modes
 	if (display_mode==DisplayMode::soft) {
-		SDL_BlitScaled(program_surface, NULL, window_surface, NULL);
+		SDL_BlitScaled(shown, NULL, window_surface, NULL);
 		SDL_UpdateWindowSurface(window);
 	}
 	//filthy hack that works, generate a texture every frame from the surface
@@ -1195,7 +5851,7 @@ void updateScreen() {
 			target_size.x = (w - target_size.w) / 2;
 		}
 		//std::cout << "w" << target_size.w << "h" << target_size.h << "\n";
-		SDL_Texture *scr = SDL_CreateTextureFromSurface(renderer, program_surface);
+		SDL_Texture *scr = SDL_CreateTextureFromSurface(renderer, shown);
 		SDL_RenderClear(renderer);
 		SDL_RenderCopy(renderer, scr, NULL, &target_size);
 		SDL_RenderPresent(renderer);
@@ -1203,6 +5859,22 @@ void updateScreen() {
 	}
 }
 
+//c_print -- Lua's print(), but to stderr (see registerLuaFn())
+int c_print(lua_State *LL) {
+	int count=lua_gettop(LL);
+	for (int ii=1; ii<=count; ii++) {
+		size_t len;
+		const char *str=luaL_tolstring(LL, ii, &len);
+		if (ii > 1) {
+			fputc('\t', stderr);
+		}
+		fwrite(str, 1, len, stderr);
+		lua_pop(LL, 1);
+	}
+	fputc('\n', stderr);
+	return 0;
+}
+
 //register lua functions and some useful globals
 void registerLuaFn() {
 	//available functions
@@ -1212,18 +5884,55 @@ void registerLuaFn() {
 	lua_register(L, "spr", c_spr);
 	lua_register(L, "text", c_text);
 	lua_register(L, "key", c_key);
+	lua_register(L, "keys", c_keys);
 	lua_register(L, "squcol", c_squcol);
 	lua_register(L, "getfps", c_getfps);
+	lua_register(L, "getstats", c_getstats);
+	lua_register(L, "newcanvas", c_newcanvas);
+	lua_register(L, "freecanvas", c_freecanvas);
+	lua_register(L, "target", c_target);
+	lua_register(L, "blit", c_blit);
+	lua_register(L, "rastercolors", c_rastercolors);
+	lua_register(L, "rasterscroll", c_rasterscroll);
+	lua_register(L, "rastermatrix", c_rastermatrix);
+	lua_register(L, "gradient", c_gradient);
+	lua_register(L, "linescroll", c_linescroll);
+	lua_register(L, "mode7", c_mode7);
+	lua_register(L, "pset", c_pset);
+	lua_register(L, "pget", c_pget);
+	lua_register(L, "line", c_line);
+	lua_register(L, "circ", c_circ);
+	lua_register(L, "circfill", c_circfill);
+	lua_register(L, "tri", c_tri);
+	lua_register(L, "trifill", c_trifill);
+	lua_register(L, "psets", c_psets);
+	lua_register(L, "lines", c_lines);
+	lua_register(L, "circs", c_circs);
+	lua_register(L, "circfills", c_circfills);
+	lua_register(L, "tris", c_tris);
+	lua_register(L, "trifills", c_trifills);
 	lua_register(L, "readfile", c_readfile);
 	lua_register(L, "writefile", c_writefile);
-	/*
-	lua_register(L, "playsong", c_playsong);
-	lua_register(L, "loopsong", c_loopsong);
-	lua_register(L, "stopsong", c_stopsong);
+	lua_register(L, "savestatus", c_savestatus);
+	lua_register(L, "rewindvars", c_rewindvars);
+	lua_register(L, "snapshot", c_snapshot);
+	lua_register(L, "restore", c_restore);
+	lua_register(L, "tone", c_tone);
+	lua_register(L, "noise", c_noise);
+	lua_register(L, "stopvoice", c_stopvoice);
 	lua_register(L, "playsound", c_playsound);
 	lua_register(L, "loopsound", c_loopsound);
 	lua_register(L, "stopsound", c_stopsound);
-	*/
+	lua_register(L, "playsong", c_playsong);
+	lua_register(L, "loopsong", c_loopsong);
+	lua_register(L, "stopsong", c_stopsong);
+	//with --capture -, stdout is the video, so anything the game prints has to go to stderr instead
+	if (capture_name=="-") {
+		lua_register(L, "print", c_print);
+		if (luaL_dostring(L, "io.output(io.stderr)")) {
+			lua_pop(L, 1);
+		}
+	}
 	//size of the display
 	lua_pushnumber(L, VIEW_WIDTH);
 	lua_setglobal(L, "view_width");
@@ -1244,34 +5953,158 @@ void registerLuaFn() {
 	lua_setglobal(L, "key_a");
 	lua_pushnumber(L,6);
 	lua_setglobal(L, "key_start");
+	lua_pushnumber(L, MAX_PLAYERS);
+	lua_setglobal(L, "max_players");
+	//synthesizer
+	lua_pushnumber(L, SYNTH_VOICES);
+	lua_setglobal(L, "synth_voices");
+	lua_pushnumber(L, NUM_CHANNELS);
+	lua_setglobal(L, "sound_channels");
+	lua_pushnumber(L, 1);
+	lua_setglobal(L, "wave_pulse12");
+	lua_pushnumber(L, 2);
+	lua_setglobal(L, "wave_pulse25");
+	lua_pushnumber(L, 4);
+	lua_setglobal(L, "wave_square");
+	lua_pushnumber(L, WAVE_TRIANGLE);
+	lua_setglobal(L, "wave_triangle");
+}
+
+//cleanup -- registered with atexit(), clean up everything at the end
+//we don't actually cleanup much right now, should really look into that, although none of the platforms we target right now have anything get left behind if we don't
+void cleanup() {
+	//bailing out early during startup can leave tasks running
+	startup_tasks.wait();
+	stopMusic();
+	if (audio_out.close(sound_freq)) {
+		QLOG(LOG_ERROR, LOG_AUDIO) << "writing to '" << audio_out_name << "' failed, the audio is incomplete!";
+	}
+	stopCapture();
+	stopScreenshots();
+	stopSaves();
+	input_log.finish();
+	hash_trace.finish();
+	//the audio thread might still be tracing
+	if (audio_id) {
+		SDL_PauseAudioDevice(audio_id, 1);
+	}
+	finishTrace();
+	stopLog();
+	SDL_Quit();
 }
 
 //initialization, main loop
 int main(int argc, char* argv[]) {
 	atexit(cleanup);
+	startLog();
+	startup_timer.begin();
 	std::cerr << "Welcome to quig! (C) 2022 B.M.Deeal.\nquig is distributed under the GNU GPLv3.\n";
-	std::cerr << "notice: quig version " << QUIG_VERSION << " now init...\n";
+	QLOG(LOG_NOTICE, LOG_CORE) << "quig version " << QUIG_VERSION << " now init...";
 	
 	//attempt to initialize Lua
 	L=luaL_newstate();
 	if (L==NULL) {
-		std::cerr << "fatal error: could not initialize Lua!" << std::endl;
+		QLOG(LOG_FATAL, LOG_LUA) << "could not initialize Lua!";
 		return 1;
 	}
 	//lua standard library
 	//TODO: should probably only open a few of the libraries -- we don't use Lua's file I/O, for starters
 	luaL_openlibs(L);
 	
+	//handle filename argument
+	QLOG(LOG_DEBUG, LOG_CORE) << "argument handling...";
+	//there needs to be at least one argument
+	//TODO: this check is old, we should check if arg_name has something
+	//TODO: like, everything about this is a bit of a mess
+	//might display some help here on the terminal, really
+	if (argc < 2) {
+		QLOG(LOG_FATAL, LOG_CORE) << "quig requires a game to run!";
+		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", "Fatal error:\nNo game to run!", window);
+		return 1;
+	}
+	//read options, filename
+	int args_quit = handleArgs(argc, argv);
+	if (args_quit) {
+		if (args_quit != 2) {
+			QLOG(LOG_FATAL, LOG_CORE) << "could not handle arguments!";
+		}
+		return 1;
+	}
+	//start tracing before anything else starts up, so it catches all of it
+	if (!trace_name.empty() && !startTrace(startup_timer.start)) {
+		QLOG(LOG_FATAL, LOG_CORE) << "could not start tracing!";
+		return 1;
+	}
+	
+	//a .quigpak has the whole game in it (see quigpak.h)
+	const std::string pak_extension=".quigpak";
+	if (arg_name.size() > pak_extension.size() && arg_name.substr(arg_name.size()-pak_extension.size())==pak_extension) {
+		if (!game_pak.open(arg_name)) {
+			QLOG(LOG_FATAL, LOG_CORE) << "could not open '" << arg_name << "' as a quig package!";
+			SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", "Fatal error:\nCould not open the game package!", window);
+			return 1;
+		}
+		QLOG(LOG_NOTICE, LOG_CORE) << "opened package '" << arg_name << "' (" << game_pak.entries.size() << " files, " << game_pak.file.size << " bytes)";
+		arg_name=arg_name.substr(0, arg_name.size()-pak_extension.size())+".quig";
+	}
+	//check for ".quig" as the end
+	//we bail if the filename is too short
+	if (arg_name.size() < 6) {
+		QLOG(LOG_FATAL, LOG_CORE) << "not a .quig file!";
+		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", "Fatal error:\nNot a .quig file!", window);
+		return 1;
+	}
+	//pull off the last 5 characters
+	std::string arg_extension=arg_name.substr(arg_name.size()-5,arg_name.size());
+	QLOG(LOG_DEBUG, LOG_CORE) << "extension is '" << arg_extension << "'";
+	//TODO: we should probably also accept .lua as an extension for a quig game maybe
+	if (arg_extension!=".quig") {
+		QLOG(LOG_FATAL, LOG_CORE) << "not a .quig file!";
+		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", "Fatal error:\nNot a .quig file!", window);
+		return 1;
+	}
+	//strip the extension
+	base_name = arg_name.substr(0,arg_name.size()-5);
+	//get the .png filename
+	gfx_name=base_name+".png";
+	QLOG(LOG_DEBUG, LOG_VIDEO) << "graphics filename is '" << gfx_name << "'";
+	
+	//get the slow stuff going while SDL starts up
+	startup_tasks.add("code", codeTask);
+	startup_tasks.add("sprites", spritesTask);
+	startup_tasks.add("fonts", fontsTask);
+	startup_tasks.add("buffers", buffersTask);
+	startup_tasks.start();
+	startup_timer.mark("lua+args");
 	//attempt to initialize SDL:
-	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-		std::cerr << "fatal error: could not initialize SDL! " << SDL_GetError() << std::endl;
+	//headless runs don't touch video at all, so they work without a display
+	if (SDL_Init(headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO) != 0) {
+		QLOG(LOG_FATAL, LOG_CORE) << "could not initialize SDL! " << SDL_GetError();
 		return 1;
 	}
+	startup_timer.mark("sdl");
+	if (headless) {
+		QLOG(LOG_NOTICE, LOG_CORE) << "running headless";
+		sound_enabled=false;
+	}
+	else {
+		pickWindowScale();
+	}
 
-	if (sound_enabled) {
-		std::cerr << "notice: initializing audio...\n";
+	if (!audio_out_name.empty()) {
+		//no device at all, so this works headless too
+		if (initSynth(sound_freq) || audio_out.open(audio_out_name.c_str(), sound_freq)) {
+			QLOG(LOG_FATAL, LOG_AUDIO) << "could not open '" << audio_out_name << "' for audio output!";
+			return 1;
+		}
+		sound_active=true;
+		offline_audio=true;
+		QLOG(LOG_NOTICE, LOG_AUDIO) << "rendering audio to '" << audio_out_name << "' at " << sound_freq << "hz";
+	}
+	else if (sound_enabled) {
+		QLOG(LOG_NOTICE, LOG_AUDIO) << "initializing audio...";
 		if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
-			std::cerr << "error: couldn't initialize SDL audio!\n";
+			QLOG(LOG_ERROR, LOG_AUDIO) << "couldn't initialize SDL audio!";
 			sound_active = false;
 		}
 		else {
@@ -1281,245 +6114,218 @@ int main(int argc, char* argv[]) {
 			want.format = AUDIO_S16SYS;
 			want.channels = 1;
 			want.samples = buffer_len;
-			want.callback = NULL;
+			want.callback = audioCallback;
 			audio_id = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+			if (audio_id && initSynth(have.freq)) {
+				QLOG(LOG_ERROR, LOG_AUDIO) << "could not set up the synthesizer! Audio is disabled.";
+				SDL_CloseAudioDevice(audio_id);
+				audio_id=0;
+			}
 			if (audio_id) {
 				sound_active = true;
-				std::cerr << "notice: enabled audio id " << audio_id <<" with frequency " << have.freq << " and buffer size " << have.samples <<".\n";
-				SDL_QueueAudio(audio_id, empty_buffer, samples_frame * 2);
-				SDL_QueueAudio(audio_id, empty_buffer, samples_frame * 2);
-				SDL_QueueAudio(audio_id, empty_buffer, samples_frame * 2);
-				SDL_QueueAudio(audio_id, empty_buffer, samples_frame * 2);
-				SDL_QueueAudio(audio_id, empty_buffer, samples_frame * 2);
-				SDL_QueueAudio(audio_id, empty_buffer, samples_frame * 2);
-				SDL_QueueAudio(audio_id, empty_buffer, samples_frame * 2);
-				SDL_QueueAudio(audio_id, empty_buffer, samples_frame * 2);
+				audio_device_samples=have.samples;
+				QLOG(LOG_NOTICE, LOG_AUDIO) << "enabled audio id " << audio_id <<" with frequency " << have.freq << " and buffer size " << have.samples <<".";
 			}
 			else {
 				sound_active = false;
 				sound_enabled = false;
-				std::cerr << "error: could not open audio device! Audio is disabled.\n";
+				QLOG(LOG_ERROR, LOG_AUDIO) << "could not open audio device! Audio is disabled.";
 			}
 		}
 	}
 	else {
-		std::cerr << "notice: audio is disabled.";
+		QLOG(LOG_NOTICE, LOG_AUDIO) << "audio is disabled.";
 		sound_active = false;
 	}
 
 	if (sound_active) {
 
 	}
+	startup_timer.mark("audio");
 	
-	//TODO: muck about with, what a total mess
-	//attempt to initialize joysticks
-	if (!SDL_InitSubSystem(SDL_INIT_JOYSTICK)) {
-		std::cerr << "notice: detected " << SDL_NumJoysticks() << " joysticks!" << std::endl;
-		if (SDL_NumJoysticks() > 1) {
-			std::cerr << "warning: quig currently only uses the first controller found; for best results, unplug other controllers!\n";
-		}
-		if (SDL_IsGameController(0)) {
-			controller = SDL_GameControllerOpen(0);
-			if (controller) {
-				std::cerr << "notice: controller found!\n";
-				const char *gcname = SDL_GameControllerName(controller);
-				if (gcname) {
-					std::cerr << "notice: controller name is '" << gcname << "'\n";
-				}
-				else {
-					std::cerr << "notice: controller name could not be found...\n";
-				}
-			}
-			else {
-			    std::cerr << "warning: could not open controller! " << SDL_GetError() << "\n";
-			}
-		}
-		else {
-			//TODO: move this around
-			std::cerr << "warning: no mappings for controller! This controller will not work with quig!\n";
-		}
+	//set up input bindings
+	defaultBindings();
+	if (bindings_name != "" && loadBindings(bindings_name)) {
+		QLOG(LOG_WARNING, LOG_INPUT) << "couldn't read bindings file '" << bindings_name << "', using the default bindings";
+	}
+	//attempt to initialize controllers
+	//we don't open any here: controllers that are already plugged in show up as SDL_CONTROLLERDEVICEADDED events just like ones plugged in later
+	if (headless) {
+		QLOG(LOG_NOTICE, LOG_INPUT) << "skipping controllers while headless";
+	}
+	else if (!SDL_InitSubSystem(SDL_INIT_GAMECONTROLLER)) {
+		QLOG(LOG_NOTICE, LOG_INPUT) << "detected " << SDL_NumJoysticks() << " joysticks!";
 	}
 	else {
-		std::cerr << "warning: could not initialize joystick subsystem!\n";
+		QLOG(LOG_WARNING, LOG_INPUT) << "could not initialize controller subsystem!";
 	}
+	startup_timer.mark("input");
 	
-	//attempt to initialize SDL_image:
-	int img_flags = IMG_INIT_PNG;
-	if ((IMG_Init(img_flags) & img_flags) != img_flags) {
-		std::cerr << "fatal error: could not initialize SDL_image! " << IMG_GetError() << std::endl;
-		return 1;
-	}
+	//SDL_image gets initialized later, only if it's needed (see initImage())
 	
-	//initialize the game screen
-	program_surface = SDL_CreateRGBSurface(0, VIEW_WIDTH, VIEW_HEIGHT, 32, 0, 0, 0, 0);
 	
-	//handle filename argument
-	if (QUIG_DEBUG) {
-		std::cerr << "debug: argument handling...\n";
-	}
-	//there needs to be at least one argument
-	//TODO: this check is old, we should check if arg_name has something
-	//TODO: like, everything about this is a bit of a mess
-	//might display some help here on the terminal, really
-	if (argc < 2) {
-		std::cerr << "fatal error: quig requires a game to run!" << std::endl;
-		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", "Fatal error:\nNo game to run!", window);
-		return 1;
-	}
-	//read options, filename
-	int args_quit = handleArgs(argc, argv);
-	if (args_quit) {
-		if (args_quit != 2) {
-			std::cerr << "fatal error: could not handle arguments!" << std::endl;
-		}
+	//attempt to create the window:
+	if (!headless && initWindow()) {
 		return 1;
 	}
-	//check for ".quig" as the end
-	//we bail if the filename is too short
-	if (arg_name.size() < 6) {
-		std::cerr << "fatal error: not a .quig file!" << std::endl;
-		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", "Fatal error:\nNot a .quig file!", window);
+	startup_timer.mark("window");
+	
+	//everything below can use what the startup tasks made
+	startup_tasks.wait();
+	startup_timer.mark("waiting");
+	
+	//the fonts and the game screen really shouldn't fail outside of OOM
+	if (startup_tasks.result("fonts")) {
+		QLOG(LOG_FATAL, LOG_VIDEO) << "could not generate fonts!";
 		return 1;
 	}
-	//pull off the last 5 characters
-	std::string arg_extension=arg_name.substr(arg_name.size()-5,arg_name.size());
-	if (QUIG_DEBUG) {
-		std::cerr << "debug: extension is '" << arg_extension << "'\n";
-	}
-	//TODO: we should probably also accept .lua as an extension for a quig game maybe
-	if (arg_extension!=".quig") {
-		std::cerr << "fatal error: not a .quig file!" << std::endl;
-		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", "Fatal error:\nNot a .quig file!", window);
+	if (startup_tasks.result("buffers")) {
+		QLOG(LOG_FATAL, LOG_VIDEO) << "could not create the game screen!";
 		return 1;
 	}
-	//strip the extension
-	base_name = arg_name.substr(0,arg_name.size()-5);
-	std::string gfx_name=base_name;
-	//get the .png filename
-	gfx_name += ".png";
-	if (QUIG_DEBUG) {
-		std::cerr << "debug: graphics filename is '" << gfx_name << "'\n";
-	}
+	//register lua functions
+	registerLuaFn();
 	
-	//attempt to create the window:
-	Uint32 full=0;
-	if (fullscreen) {
-		full=SDL_WINDOW_FULLSCREEN_DESKTOP;
-	}
-	window = SDL_CreateWindow("quig simple game system", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_width, window_height, SDL_WINDOW_SHOWN | full);
-	if (window == NULL) {
-		std::cerr << "fatal error: could not create window! " << SDL_GetError() << std::endl;
+	//set up frame hash traces
+	if (!hash_trace_name.empty() && !hash_trace.startTrace(hash_trace_name)) {
+		QLOG(LOG_FATAL, LOG_VIDEO) << "could not write hash trace '" << hash_trace_name << "'!";
 		return 1;
 	}
-	
-	//software final blits
-	//TODO: really, these should be unified and all use the renderer API
-	//in fact, all of quig should, but eh
-	if (display_mode==DisplayMode::soft) {
-		std::cerr << "notice: using software driven window\n";
-		window_surface = SDL_GetWindowSurface(window);
-		SDL_FillRect(window_surface, NULL, SDL_MapRGB(window_surface->format, 0xFF, 0xFF, 0xFF));
-	}
-	//hardware accelerated final blits
-	else {
-		std::cerr << "notice: using hardware drawn window\n";
-		Uint32 vsync_on=0;
-		if (display_mode==DisplayMode::hard_vsync) {
-			std::cerr<<"notice: vsync enabled\n";
-			vsync_on = SDL_RENDERER_PRESENTVSYNC;
-		}
-		else {
-			std::cerr<<"notice: vsync disabled\n";
-		}
-		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | vsync_on);
-		//TODO: should we just go and attempt to try software mode? I think just failing out is the right thing, most machines should not be using software mode unless something is wrong
-		if (renderer == NULL) {
-			std::cerr << "fatal error: could not create renderer!" << std::endl;
-			SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", "Fatal error:\nCould not create renderer!", window);
+	if (!hash_verify_name.empty()) {
+		if (!hash_trace.startVerify(hash_verify_name)) {
+			QLOG(LOG_FATAL, LOG_VIDEO) << "could not read hash trace '" << hash_verify_name << "'!";
 			return 1;
 		}
+		QLOG(LOG_NOTICE, LOG_VIDEO) << "verifying frames against '" << hash_verify_name << "'";
 	}
+	hash_trace.dump_frame=hash_dump_frame;
 	
-	//generate the four font styles
-	if (QUIG_DEBUG) {
-		std::cerr << "debug: generating fonts...\n";
+	//set up input logging/replay, which needs math.random seeded before any game code runs
+	if (!replay_name.empty()) {
+		if (!input_log.startReplay(replay_name)) {
+			QLOG(LOG_FATAL, LOG_INPUT) << "could not read input log '" << replay_name << "'!";
+			return 1;
+		}
+		QLOG(LOG_NOTICE, LOG_INPUT) << "replaying " << input_log.replay_keys.size() << " frames from '" << replay_name << "'";
+		seedLua(input_log.seed);
 	}
-	for (int ff=0; ff<4; ff++) {
-		generateFont(ff);
-		if (font[ff]==NULL) {
-			//this really shouldn't happen outside of OOM
-			std::cerr << "fatal error: could not generate fonts!";
+	else if (!record_input_name.empty()) {
+		if (!input_log.startRecording(record_input_name, (Uint32)time(NULL) ^ (Uint32)SDL_GetPerformanceCounter())) {
+			QLOG(LOG_FATAL, LOG_INPUT) << "could not write input log '" << record_input_name << "'!";
 			return 1;
 		}
+		QLOG(LOG_NOTICE, LOG_INPUT) << "recording inputs to '" << record_input_name << "'";
+		seedLua(input_log.seed);
 	}
-	//register lua functions
-	registerLuaFn();
 	
-	//load the Lua code
-	if (QUIG_DEBUG) {
-		std::cerr << "debug: loading Lua code...\n";
-	}
+	//run the Lua code (it was compiled by codeTask())
+	QLOG(LOG_DEBUG, LOG_LUA) << "running Lua code...";
 	//error with the lua code (usually, just a syntax error, but maybe you passed something that wasn't lua code at all or the file doesn't exist)
-	if (luaL_dofile(L, arg_name.c_str())) {
-		std::cerr << "fatal error: could not load Lua code! " << lua_tostring(L,-1) << std::endl;
+	if (startup_tasks.result("code") || lua_pcall(L, 0, LUA_MULTRET, 0)) {
+		QLOG(LOG_FATAL, LOG_LUA) << "could not load Lua code! " << lua_tostring(L,-1);
 		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", lua_tostring(L,-1), window);
 		lua_pop(L,1);
 		return 1;
 	}
+	startup_timer.mark("code");
 	
-	//load user graphics
+	//user graphics (loaded by spritesTask())
 	//TODO: this should maybe not be a fatal error? maybe?
-	sprites=IMG_Load(gfx_name.c_str());
 	if (sprites==NULL) {
-		std::cerr << "fatal error: could not load graphics!" << std::endl;
+		QLOG(LOG_FATAL, LOG_VIDEO) << "could not load graphics!";
 		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", "Fatal error:\nCould not load graphics!", window);
 		return 1;
 	}
 	//magic pink (#FF00FF) is transparent
 	SDL_SetColorKey(sprites, SDL_TRUE, SDL_MapRGB(sprites->format, 0xFF, 0x00, 0xFF));
 	
+	//start watching for changes
+	if (watch_enabled && game_pak.active()) {
+		QLOG(LOG_WARNING, LOG_CORE) << "packages can't be watched for changes, --watch is off";
+		watch_enabled=false;
+	}
+	//a reload partway through would make the log or trace useless, same as rewinding would
+	if (watch_enabled && (input_log.active() || hash_trace.active() || hash_trace.dump_frame >= 0)) {
+		QLOG(LOG_WARNING, LOG_CORE) << "--watch is off while recording or replaying input or checking hashes";
+		watch_enabled=false;
+	}
+	if (watch_enabled) {
+		file_watcher.start(arg_name, gfx_name);
+	}
+	
 	//used to calculate fps
 	FrameTimer fps_timer;
 	fps_timer.setTime();
 	
-	//setup recording
-	initRecording();
+	//setup recording (the GIF buffers were made by buffersTask())
+	initCapture();
+	initScreenshots();
+	startup_timer.mark("buffers");
 	
 	//setup audio
 	do_cls(0,0,0);
 	updateScreen();
-	//initAudio();
+	loadSounds();
+	initMusic();
 	SDL_PauseAudioDevice(audio_id, 0);
+	startup_timer.mark("sounds");
 	
 	//main loop
 	bool running = true;
 	SDL_Event e;
-	std::cerr << "notice: quig init complete, entering main loop...\n";
+	QLOG(LOG_NOTICE, LOG_CORE) << "quig init complete, entering main loop...";
 	//error in user lua code
 	if (init_fn()) {
-		std::cerr << "fatal error: lua error during init()! " << lua_tostring(L,-1) << std::endl;
+		QLOG(LOG_FATAL, LOG_LUA) << "lua error during init()! " << lua_tostring(L,-1);
 		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", lua_tostring(L,-1), window);
 		lua_pop(L,1);
 		return 1;
 	}
+	startup_timer.mark("init()");
+	startup_timer.report();
 	//hide the mouse
 	SDL_ShowCursor(SDL_DISABLE);
+	//frame timing needs to know how fast the display is when it's vsynced
+	SDL_DisplayMode refresh_mode;
+	int refresh=FPS_RATE;
+	if (!headless && !SDL_GetWindowDisplayMode(window, &refresh_mode) && refresh_mode.refresh_rate > 0) {
+		refresh=refresh_mode.refresh_rate;
+	}
+	pacer.init(display_mode==DisplayMode::hard_vsync, refresh);
+	if (low_latency && !headless) {
+		QLOG(LOG_NOTICE, LOG_CORE) << "low latency mode on, frames start as late as they safely can";
+	}
+	//used to report how fast headless runs went
+	FrameTimer run_timer;
+	run_timer.setTime();
 	//the main loop itself
 	int second_count=0;
-	int debug_audio_frames = 0;
+	int capture_dropped_shown=0;
 	while (running) {
-		debug_audio_frames=(debug_audio_frames+1)%60;
+		TRACE_SCOPE("frame");
+		if (low_latency && !headless) {
+			TRACE_SCOPE("sleep");
+			pacer.wait();
+		}
+		pacer.begin();
 		timer.setTime();
 		bool sshot=false;
+		bool had_input=false;
+		Uint32 input_ticks=0;
 		//handle events
+		Uint64 poll_start=tracing() ? SDL_GetPerformanceCounter() : 0;
 		while (SDL_PollEvent(&e)) {
+			//note when the oldest input came in, for measuring latency
+			if (!had_input && (e.type==SDL_KEYDOWN || e.type==SDL_KEYUP || (e.type >= SDL_JOYAXISMOTION && e.type <= SDL_CONTROLLERBUTTONUP))) {
+				had_input=true;
+				input_ticks=e.common.timestamp;
+			}
 			//user closes the window normally
 			if (e.type == SDL_QUIT) {
 				running = false;
 			}
 			//key inputs
-			//TODO: joypad
-			//TODO: move to function
+			//quig's own keys are handled here, the game's keys go through the bindings
 			else if (e.type == SDL_KEYDOWN && e.key.repeat==0) {
 				switch (e.key.keysym.sym) {
 					//quit
@@ -1529,6 +6335,15 @@ int main(int argc, char* argv[]) {
 					case (SDLK_ESCAPE):
 						running = false;
 					break;
+					//stats overlay
+					case (SDLK_F3):
+						show_stats=!show_stats;
+					break;
+					//toggle fast-forward
+					case (SDLK_F5):
+						turbo=!turbo;
+						QLOG(LOG_NOTICE, LOG_CORE) << "fast-forward " << (turbo ? "on" : "off");
+					break;
 					//screenshot
 					case (SDLK_F6):
 						sshot=true;
@@ -1538,260 +6353,174 @@ int main(int argc, char* argv[]) {
 					case (SDLK_F8):
 						recording=true;
 					break;
-					//d-pad
-					//TODO: ijkl? really, this should all just end up being remappable though
-					case (SDLK_UP):
-						if (inputs.keys[inputs.UP] == 0) {
-							inputs.keys[inputs.UP]=1;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: pressed up!\n";
-							}
-						}				
-					break;
-					case (SDLK_DOWN):
-						if (inputs.keys[inputs.DOWN] == 0) {
-							inputs.keys[inputs.DOWN]=1;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: pressed down!\n";
-							}
-						}
-					break;
-					case (SDLK_LEFT):
-						if (inputs.keys[inputs.LEFT] == 0) {
-							inputs.keys[inputs.LEFT]=1;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: pressed left!\n";
-							}
-						}
-					break;
-					case (SDLK_RIGHT):
-						if (inputs.keys[inputs.RIGHT] == 0) {
-							inputs.keys[inputs.RIGHT]=1;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: pressed right!\n";
-							}
-						}
-					break;
-					//start button
-					case (SDLK_RETURN):
-					case (SDLK_RETURN2):
-						if (inputs.keys[inputs.START] == 0) {
-							inputs.keys[inputs.START]=1;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: pressed start-button!\n";
-							}
-						}
-					break;
-					//A button (ostensibly, the one to the (bottom) left)
-					case (SDLK_z):
-					case (SDLK_s):
-					case (SDLK_q):
-					case (SDLK_2):
-						if (inputs.keys[inputs.A] == 0) {
-							inputs.keys[inputs.A]=1;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: pressed A-button!\n";
-							}
-						}
+					//rewind (as long as it's held), but not while input is being logged or checked, since it'd throw everything off
+					case (SDLK_BACKSPACE):
+						rewind_held=!(input_log.active() || hash_trace.active());
 					break;
-					//B button (ostensibly, the one to the (far) right)
-					case (SDLK_x):
-					case (SDLK_a):
-					case (SDLK_w):
-					case (SDLK_1):
-						if (inputs.keys[inputs.B] == 0) {
-							inputs.keys[inputs.B]=1;
-						}
-						if (QUIG_DEBUG) {
-							std::cerr << "debug: pressed B-button!\n";
-						}
+					//everything else might be bound to a key (see defaultBindings())
+					default:
+						keyEvent(e.key.keysym.sym, true);
 					break;
 				}
 			}
 			else if (e.type == SDL_KEYUP && e.key.repeat==0) {
-				switch (e.key.keysym.sym) {
-					//d-pad
-					//TODO: ijkl?
-					case (SDLK_UP):
-						if (inputs.keys[inputs.UP] != 0) {
-							inputs.keys[inputs.UP]=0;
-							inputs.keys_held[inputs.UP]=0;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: released up!\n";
-							}
-						}
-					break;
-					case (SDLK_DOWN):
-						if (inputs.keys[inputs.DOWN] != 0) {
-							inputs.keys[inputs.DOWN]=0;
-							inputs.keys_held[inputs.DOWN]=0;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: released down!\n";
-							}
-						}
-					break;
-					case (SDLK_LEFT):
-						if (inputs.keys[inputs.LEFT] != 0) {
-							inputs.keys[inputs.LEFT]=0;
-							inputs.keys_held[inputs.LEFT]=0;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: released left!\n";
-							}
-						}
-					break;
-					case (SDLK_RIGHT):
-						if (inputs.keys[inputs.RIGHT] != 0) {
-							inputs.keys[inputs.RIGHT]=0;
-							inputs.keys_held[inputs.RIGHT]=0;
-						}
-						if (QUIG_DEBUG) {
-							std::cerr << "debug: released right!\n";
-						}
-					break;
-					//start button
-					case (SDLK_RETURN):
-					case (SDLK_RETURN2):
-						if (inputs.keys[inputs.START] != 0) {
-							inputs.keys[inputs.START]=0;
-							inputs.keys_held[inputs.START]=0;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: released start-button!\n";
-							}
-						}
-					break;
-					//A button (the one on the bottom/left of the B-button)
-					case (SDLK_z):
-					case (SDLK_s):
-					case (SDLK_q):
-					case (SDLK_2):
-						if (inputs.keys[inputs.A] != 0) {
-							inputs.keys[inputs.A]=0;
-							inputs.keys_held[inputs.A]=0;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: released A-button!\n";
-							}
-						}
-					break;
-					//B button (the one to the right of the A-button)
-					case (SDLK_x):
-					case (SDLK_a):
-					case (SDLK_w):
-					case (SDLK_1):
-						if (inputs.keys[inputs.B] != 0) {
-							inputs.keys[inputs.B]=0;
-							inputs.keys_held[inputs.B]=0;
-							if (QUIG_DEBUG) {
-								std::cerr << "debug: released B-button!\n";
-							}
-						}
-					break;
+				if (e.key.keysym.sym==SDLK_BACKSPACE) {
+					rewind_held=false;
 				}
+				keyEvent(e.key.keysym.sym, false);
+			}
+			//controllers coming and going
+			else if (e.type == SDL_CONTROLLERDEVICEADDED || e.type == SDL_JOYDEVICEADDED) {
+				addController(e.cdevice.which);
+			}
+			else if (e.type == SDL_CONTROLLERDEVICEREMOVED) {
+				removeController(e.cdevice.which);
 			}
 		}
-		//handle held-down keys:
-		inputs.update();
-		//read and merge controller inputs with keyboard inputs
-		//seems to work fine with Xbox and PS3 controllers on Linux out of the box
-		//yeah, this whole pile is kinda awful and I hate it
-		if (controller) {
-			controllerState.readState();
+		if (poll_start) {
+			traceEvent("poll events", poll_start, SDL_GetPerformanceCounter());
 		}
+		//pick up any changes to the game's files
+		if (watch_enabled) {
+			file_watcher.poll();
+			if (file_watcher.ready()) {
+				hotReload();
+			}
+		}
+		//run the game, several times per shown frame when fast-forwarding
+		//frames that won't be shown skip all of their drawing, unless something needs to see every single frame
+		//(a replay has to draw everything too: if the game uses pget(), a skipped frame would read back something different than when it was recorded)
+		int steps=turbo ? turbo_steps : 1;
+		bool can_skip=!(input_log.active() || hash_trace.active() || hash_trace.dump_frame >= 0 || pixels_read);
+		for (int ss=0; ss<steps && running; ss++) {
+			render_skip=(can_skip && ss<steps-1);
+			{
+				TRACE_SCOPE("merge input");
+				//read the keyboard and every controller
+				updateInputs();
+				//swap in (or log) what the game sees for replays
+				if (input_log.replaying) {
+					input_log.replay(players);
+				}
+				else if (input_log.recording) {
+					input_log.record(players);
+				}
+			}
 		
-		inputs_final.keys[inputs.UP]=max3(
-			inputs.keys[inputs.UP],
-			controllerState.buttons[controllerState.u],
-			controllerState.stick_up
-		);
-		
-		inputs_final.keys[inputs.DOWN]=max3(
-			inputs.keys[inputs.DOWN],
-			controllerState.buttons[controllerState.d],
-			controllerState.stick_down
-		);
-		
-		inputs_final.keys[inputs.LEFT]=max3(
-			inputs.keys[inputs.LEFT],
-			controllerState.buttons[controllerState.l],
-			controllerState.stick_left
-		);
-		
-		inputs_final.keys[inputs.RIGHT]=max3(
-			inputs.keys[inputs.RIGHT],
-			controllerState.buttons[controllerState.r],
-			controllerState.stick_right
-		);
-		inputs_final.keys[inputs.START]=max2(inputs.keys[inputs.START], controllerState.buttons[controllerState.s]);
-		inputs_final.keys[inputs.B]=max2(inputs.keys[inputs.B], controllerState.button_quig_b);
-		inputs_final.keys[inputs.A]=max2(inputs.keys[inputs.A], controllerState.button_quig_a);
-		
-		//update game, give the user an error if something goes wrong (usually just a syntax error)
-		if (step_fn()) {
-			std::cerr << "fatal error: lua error during step()! " << lua_tostring(L,-1) << std::endl;
-			SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", lua_tostring(L,-1), window);
-			lua_pop(L,1);
-			return 1;
+			//update game, give the user an error if something goes wrong (usually just a syntax error)
+			//while rewinding, the game goes back a snapshot instead
+			bool rewound=rewind_held && rewind_state.available();
+			bool failed;
+			{
+				TRACE_SCOPE(rewound ? "rewind" : "step");
+				failed=rewound ? rewind_state.back(L, !render_skip) : step_fn();
+			}
+			if (failed) {
+				QLOG(LOG_FATAL, LOG_LUA) << "lua error during step()! " << lua_tostring(L,-1);
+				SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "quig fatal error!", lua_tostring(L,-1), window);
+				lua_pop(L,1);
+				return 1;
+			}
+			if (!rewound && rewind_state.enabled()) {
+				TRACE_SCOPE("snapshot");
+				rewind_state.record(L);
+			}
+			if (offline_audio) {
+				TRACE_SCOPE("render audio");
+				renderAudioFrame();
+			}
+			//hash the frame for replays and traces, and stop once the replay's done
+			//(a skipped frame wasn't drawn, so there's nothing to hash)
+			if (input_log.active() || hash_trace.active() || hash_trace.dump_frame >= 0) {
+				TRACE_SCOPE("hash frame");
+				Uint64 hash=render_skip ? 0 : hashFrame(program_surface);
+				input_log.endFrame(hash, !render_skip);
+				if (!render_skip) {
+					hash_trace.endFrame(hash, program_surface);
+				}
+			}
+			frame_number++;
+			if (input_log.finished()) {
+				running=false;
+			}
 		}
+		render_skip=false;
 		
 		//alternate button to record:
-		if (controllerState.buttons[controllerState.sel]==1) {
+		if (controllerBackPressed()) {
 			recording=true;
 		}
 		
 		//save a screenshot if requested
-		//TODO: numbering, so the user can take multiple shots and decide the best one
-		//or maybe just timestamps, which saves a lot of effort
 		if (sshot) {
-			IMG_SavePNG(program_surface,"quig-sshot.png");
+			takeScreenshot(frame_number);
 		}
 		//handle recording
-		doRecording();
+		{
+			TRACE_SCOPE("record");
+			doRecording();
+			doCapture();
+		}
 		//draw everything
-		updateScreen();
-
-		if (sound_active) {
-			int queued_length = SDL_GetQueuedAudioSize(audio_id);
-			//DEBUG AUDIO STUFF
-			std::cerr << "debug: buffered " << queued_length << " samples.\n";
-			if (inputs_final.keys[inputs.A]) {
-				if (debug_audio_frames > 30) {
-					generateTone(200);
-				}
-				else {
-					generateTone(400);
-				}
-			}
-			else {
-				generateTone(0);
-			}
-			SDL_QueueAudio(audio_id, audio_buffer, (samples_frame + samples_frame_offset) * 2);
-			if (queued_length > 3072) {
-				samples_frame_offset = -samples_frame_offset_max;
-			}
-			else if (queued_length < 1024) {
-				samples_frame_offset = samples_frame_offset_max;
-			}
-			else {
-				samples_frame_offset = 0;
-			}
+		pacer.drawing();
+		{
+			TRACE_SCOPE("update screen");
+			updateScreen();
+		}
+		pacer.shown(had_input, input_ticks);
+		if (!startup_timer.shown) {
+			startup_timer.firstFrame();
+		}
+
+		//let the mixer know how far along the game is
+		{
+			TRACE_SCOPE("sync audio");
+			publishGameFrame();
 		}
 		//calculate FPS
 		second_count++;
 		if (second_count > FPS_RATE) {
 			avg_fps=second_count / (fps_timer.getTime()/1000.0);
-			//if (QUIG_DEBUG) {
-			//	std::cerr << "debug: fps: " << avg_fps << "\n";
-			//}
+			//QLOG(LOG_DEBUG, LOG_VIDEO) << "fps: " << avg_fps;
+			//complain (once a second at most) if capture can't keep up
+			if (capture_pool.dropped > capture_dropped_shown) {
+				QLOG(LOG_WARNING, LOG_VIDEO) << "capture is falling behind, " << capture_pool.dropped << " frames dropped so far";
+				capture_dropped_shown=capture_pool.dropped;
+			}
 			second_count = 0;
 			fps_timer.setTime();
 		}
 		
-		//cap FPS when vsync is off
-		if (display_mode != DisplayMode::hard_vsync) {
+		//cap FPS when vsync is off (and run flat out when headless, and the pacer's already waited in low latency mode)
+		if (!headless && !low_latency && display_mode != DisplayMode::hard_vsync) {
 			int frame_time = timer.getTime();
 			if (frame_time < FPS_TICKS) {
+				TRACE_SCOPE("sleep");
 				SDL_Delay(FPS_TICKS - frame_time);
 			}
 		}
 	}	
+	if (sound_active && !offline_audio) {
+		QLOG(LOG_DEBUG, LOG_AUDIO) << "audio was running " << SDL_AtomicGet(&audio_fill_us)/1000.0 << "ms behind the game, " << SDL_AtomicGet(&audio_latency_us)/1000.0 << "ms latency in all, resampling by " << SDL_AtomicGet(&audio_rate_ppm) << "ppm";
+	}
+	if (!headless && pacer.input_latency_max > 0) {
+		std::ostringstream late;
+		if (low_latency) {
+			late << ", " << pacer.late_frames << " frames were late";
+		}
+		QLOG(LOG_NOTICE, LOG_INPUT) << "input took " << pacer.input_latency << "ms on average to show up on screen (" << pacer.input_latency_max << "ms at worst)" << late.str();
+	}
+	if (headless) {
+		double seconds=run_timer.getTime()/1000.0;
+		QLOG(LOG_NOTICE, LOG_CORE) << "ran " << frame_number << " frames in " << seconds << " seconds (" << (seconds > 0 ? frame_number/seconds : 0) << " frames per second)";
+	}
+	if (offline_audio && frame_number > 0) {
+		double audio_ms=offline_render_time*1000.0/SDL_GetPerformanceFrequency();
+		QLOG(LOG_NOTICE, LOG_AUDIO) << "audio took " << audio_ms << "ms to render (" << audio_ms*1000/frame_number << "us per frame)";
+	}
+	//a replay or trace that didn't match counts as a failure, so scripts can check for it
+	if (input_log.mismatches || hash_trace.mismatches) {
+		return 1;
+	}
 	return 0;
 }
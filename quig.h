@@ -1,7 +1,7 @@
 void setPixel(SDL_Surface *target, int x, int y, Uint32 color);
 SDL_Surface* generateFont(int mode);
 void cleanup();
-int do_key(int key);
+int do_key(int key, int player=0);
 int c_key(lua_State *LL);
 int init_fn();
 int step_fn();
@@ -11,7 +11,7 @@ void do_rect(int x, int y, int w, int h, int r, int g, int b);
 int c_rect(lua_State *LL);
 void do_spr(int x, int y, double scale, int sx, int sy);
 int c_spr(lua_State *LL);
-void do_text(const char *str, int x, int y, double scale, int mode);
+void do_text(const char *str, int x, int y, double scale, int mode, SDL_Surface *dest=NULL);
 int c_text(lua_State *LL);
 bool do_squcol(int x1, int y1, int s1, int x2, int y2, int s2);
 int c_squcol(lua_State *LL);
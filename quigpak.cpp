@@ -0,0 +1,225 @@
+/*
+	quigpak - packs a quig game into a single .quigpak file
+	(C) 2022 B.M.Deeal <brenden.deeal@gmail.com>
+
+	This program is free software: you can redistribute it and/or modify it under the terms of version 3 of the GNU General Public License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program.
+    If not, see <https://www.gnu.org/licenses/>.
+
+	---
+
+	usage: quigpak [--bytecode] game.quig [game.quigpak]
+	picks up game.png, game.snd0.wav to game.snd31.wav and game.song0 to game.song31 (.ogg or .wav) from next to game.quig, same as quig itself does
+	the sprite sheet is decoded here, so quig doesn't have to when it starts up
+	see quigpak.h for the format
+*/
+
+#include <SDL.h>
+#include <SDL_image.h>
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <iterator>
+#include "quigpak.h"
+
+const int SOUND_MAX=32;
+const int SONG_MAX=32;
+
+//builds up a package in memory
+struct PakWriter {
+	std::vector<Uint8> data;
+	std::vector<PakEntry> entries;
+	PakWriter() {
+		data.resize(PAK_HEADER_SIZE, 0);
+	}
+	void putU32(std::vector<Uint8> &out, size_t pos, Uint32 v) {
+		for (int ii=0; ii<4; ii++) {
+			out[pos+ii]=(v >> (ii*8)) & 0xFF;
+		}
+	}
+	void putU64(std::vector<Uint8> &out, size_t pos, Uint64 v) {
+		putU32(out, pos, v & 0xFFFFFFFF);
+		putU32(out, pos+4, v >> 32);
+	}
+	void align() {
+		data.resize((data.size()+PAK_ALIGN-1)/PAK_ALIGN*PAK_ALIGN, 0);
+	}
+	//add an entry, returns false if the name's too long
+	bool add(const std::string &name, int type, const void *bytes, size_t size) {
+		if (name.size() >= (size_t)PAK_NAME_MAX) {
+			return false;
+		}
+		align();
+		PakEntry entry;
+		entry.name=name;
+		entry.offset=data.size();
+		entry.size=size;
+		entry.type=type;
+		entries.push_back(entry);
+		data.insert(data.end(), (const Uint8*)bytes, (const Uint8*)bytes+size);
+		return true;
+	}
+	//write out the index and the whole thing, returns false if it can't be written
+	bool save(const std::string &name) {
+		align();
+		Uint64 index=data.size();
+		for (size_t ii=0; ii<entries.size(); ii++) {
+			size_t pos=data.size();
+			data.resize(pos+PAK_ENTRY_SIZE, 0);
+			memcpy(&data[pos], entries[ii].name.c_str(), entries[ii].name.size());
+			putU64(data, pos+PAK_NAME_MAX, entries[ii].offset);
+			putU32(data, pos+PAK_NAME_MAX+8, entries[ii].size);
+			putU32(data, pos+PAK_NAME_MAX+12, entries[ii].type);
+		}
+		memcpy(&data[0], PAK_MAGIC, 8);
+		putU32(data, 8, entries.size());
+		putU64(data, 12, index);
+		std::ofstream outfile(name.c_str(), std::ios::binary);
+		outfile.write((const char*)data.data(), data.size());
+		return (bool)outfile;
+	}
+};
+
+//read a whole file, returns false if it isn't there
+bool readFile(const std::string &name, std::vector<Uint8> &out) {
+	std::ifstream infile(name.c_str(), std::ios::binary);
+	if (!infile) {
+		return false;
+	}
+	out.assign(std::istreambuf_iterator<char>(infile), std::istreambuf_iterator<char>());
+	return true;
+}
+
+//lua_dump writer, collects the bytecode
+int dumpWriter(lua_State *LL, const void *bytes, size_t size, void *out) {
+	std::vector<Uint8> *code=(std::vector<Uint8>*)out;
+	code->insert(code->end(), (const Uint8*)bytes, (const Uint8*)bytes+size);
+	return 0;
+}
+
+//decode the sprite sheet into a format quig can blit from directly, returns false if it can't
+bool addSprites(PakWriter &pak, const std::string &name) {
+	SDL_Surface *loaded=IMG_Load(name.c_str());
+	if (!loaded) {
+		std::cerr << "fatal error: could not load '" << name << "'! " << IMG_GetError() << "\n";
+		return false;
+	}
+	if (loaded->w > PAK_SPRITES_MAX || loaded->h > PAK_SPRITES_MAX) {
+		std::cerr << "fatal error: '" << name << "' is too big, sprite sheets can be up to " << PAK_SPRITES_MAX << "x" << PAK_SPRITES_MAX << "!\n";
+		SDL_FreeSurface(loaded);
+		return false;
+	}
+	SDL_Surface *converted=convertSprites(loaded);
+	SDL_FreeSurface(loaded);
+	if (!converted) {
+		std::cerr << "fatal error: could not convert '" << name << "'! " << SDL_GetError() << "\n";
+		return false;
+	}
+	std::vector<Uint8> out;
+	packSprites(converted, out);
+	std::cerr << "notice: sprite sheet is " << converted->w << "x" << converted->h << "\n";
+	SDL_FreeSurface(converted);
+	return pak.add("sprites", PAK_SPRITES, out.data(), out.size());
+}
+
+int main(int argc, char *argv[]) {
+	bool bytecode=false;
+	std::string in_name, out_name;
+	for (int ii=1; ii<argc; ii++) {
+		std::string current=argv[ii];
+		if (current=="--bytecode") {
+			bytecode=true;
+		}
+		else if (in_name.empty()) {
+			in_name=current;
+		}
+		else if (out_name.empty()) {
+			out_name=current;
+		}
+		else {
+			std::cerr << "fatal error: unknown argument '" << current << "'!\n";
+			return 1;
+		}
+	}
+	if (in_name.size() < 6 || in_name.substr(in_name.size()-5)!=".quig") {
+		std::cerr << "usage: quigpak [--bytecode] game.quig [game.quigpak]\n"
+			<< "  --bytecode: also store precompiled Lua code, which starts faster but only works on the same kind of system it was made on (the source is kept too, as a fallback)\n";
+		return 1;
+	}
+	std::string base_name=in_name.substr(0, in_name.size()-5);
+	if (out_name.empty()) {
+		out_name=base_name+".quigpak";
+	}
+	PakWriter pak;
+
+	//the code
+	std::vector<Uint8> source;
+	if (!readFile(in_name, source)) {
+		std::cerr << "fatal error: could not read '" << in_name << "'!\n";
+		return 1;
+	}
+	lua_State *L=luaL_newstate();
+	if (luaL_loadbuffer(L, (const char*)source.data(), source.size(), ("@"+in_name).c_str())) {
+		std::cerr << "fatal error: could not compile '" << in_name << "'! " << lua_tostring(L,-1) << "\n";
+		return 1;
+	}
+	pak.add("quig", PAK_LUA_SOURCE, source.data(), source.size());
+	if (bytecode) {
+		std::vector<Uint8> code;
+		lua_dump(L, dumpWriter, &code, 0);
+		pak.add("quigc", PAK_LUA_BYTECODE, code.data(), code.size());
+		std::cerr << "notice: precompiled " << source.size() << " bytes of Lua into " << code.size() << " bytes of bytecode\n";
+	}
+	lua_close(L);
+
+	//the sprite sheet
+	IMG_Init(IMG_INIT_PNG);
+	if (!addSprites(pak, base_name+".png")) {
+		return 1;
+	}
+
+	//sounds and music, as-is
+	int sound_count=0;
+	for (int ii=0; ii<SOUND_MAX; ii++) {
+		std::stringstream name;
+		name << "snd" << ii << ".wav";
+		std::vector<Uint8> file;
+		if (readFile(base_name+"."+name.str(), file)) {
+			pak.add(name.str(), PAK_RAW, file.data(), file.size());
+			sound_count++;
+		}
+	}
+	int song_count=0;
+	const char *song_types[]={".ogg", ".wav"};
+	for (int ii=0; ii<SONG_MAX; ii++) {
+		for (int tt=0; tt<2; tt++) {
+			std::stringstream name;
+			name << "song" << ii << song_types[tt];
+			std::vector<Uint8> file;
+			if (readFile(base_name+"."+name.str(), file)) {
+				pak.add(name.str(), PAK_RAW, file.data(), file.size());
+				song_count++;
+			}
+		}
+	}
+	std::cerr << "notice: packed " << sound_count << " sounds and " << song_count << " songs\n";
+
+	if (!pak.save(out_name)) {
+		std::cerr << "fatal error: could not write '" << out_name << "'!\n";
+		return 1;
+	}
+	std::cerr << "notice: wrote " << pak.data.size() << " bytes to '" << out_name << "'\n";
+	IMG_Quit();
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+	quigpak.h - the .quigpak game package format, shared by quig and the quigpak tool
+	(C) 2022 B.M.Deeal <brenden.deeal@gmail.com>
+
+	This program is free software: you can redistribute it and/or modify it under the terms of version 3 of the GNU General Public License as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with this program.
+    If not, see <https://www.gnu.org/licenses/>.
+
+	---
+
+	a .quigpak is a whole game in one file, meant to be memory-mapped and used in place:
+	* header (PAK_HEADER_SIZE bytes): "QUIGPAK1", entry count (4 bytes), index offset (8 bytes), then zeroes
+	* entry data, each one starting on a PAK_ALIGN boundary
+	* the index, PAK_ENTRY_SIZE bytes per entry: name (PAK_NAME_MAX bytes, zero padded), offset (8 bytes), size (4 bytes), type (4 bytes)
+	everything is little-endian
+
+	entries are named after the loose file they replace, minus the game's name, eg, "snd0.wav" or "song1.ogg"
+	the game's code is "quig" (source) and/or "quigc" (precompiled bytecode, which only works on the same kind of system it was built on, so the source is kept as a fallback)
+	the sprite sheet is "sprites", already decoded: a PAK_ALIGN sized header (width, height, pitch, SDL pixel format, 4 bytes each) and then the pixels
+	(quig's decoded sprite sheet cache uses the same layout, see loadSprites())
+*/
+
+#ifndef QUIGPAK_H
+#define QUIGPAK_H
+
+#include <SDL.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+const char PAK_MAGIC[]="QUIGPAK1";
+const int PAK_HEADER_SIZE=64;
+const int PAK_ALIGN=64; //a cache line, and plenty for SIMD loads
+const int PAK_ENTRY_SIZE=64;
+const int PAK_NAME_MAX=48;
+const int PAK_SPRITES_MAX=16384; //biggest sprite sheet width or height that gets loaded
+enum PakType {
+	PAK_RAW=0, PAK_LUA_SOURCE, PAK_LUA_BYTECODE, PAK_SPRITES
+};
+
+struct PakEntry {
+	std::string name;
+	unsigned long long offset;
+	unsigned int size;
+	unsigned int type;
+};
+
+inline unsigned int pakGetU32(const unsigned char *in) {
+	return in[0] | (in[1] << 8) | (in[2] << 16) | ((unsigned int)in[3] << 24);
+}
+inline unsigned long long pakGetU64(const unsigned char *in) {
+	return pakGetU32(in) | ((unsigned long long)pakGetU32(in+4) << 32);
+}
+
+//read the index of a package in memory, returns false if it isn't one or it's damaged
+inline bool readPakIndex(const unsigned char *data, size_t size, std::vector<PakEntry> &entries) {
+	entries.clear();
+	if (size < (size_t)PAK_HEADER_SIZE || memcmp(data, PAK_MAGIC, 8)) {
+		return false;
+	}
+	unsigned int count=pakGetU32(data+8);
+	unsigned long long index=pakGetU64(data+12);
+	if (index > size || count > (size-index)/PAK_ENTRY_SIZE) {
+		return false;
+	}
+	for (unsigned int ii=0; ii<count; ii++) {
+		const unsigned char *raw=data+index+ii*PAK_ENTRY_SIZE;
+		PakEntry entry;
+		entry.name=std::string((const char*)raw, strnlen((const char*)raw, PAK_NAME_MAX));
+		entry.offset=pakGetU64(raw+PAK_NAME_MAX);
+		entry.size=pakGetU32(raw+PAK_NAME_MAX+8);
+		entry.type=pakGetU32(raw+PAK_NAME_MAX+12);
+		if (entry.offset > size || entry.size > size-entry.offset) {
+			return false;
+		}
+		entries.push_back(entry);
+	}
+	return true;
+}
+
+//convert a loaded sprite sheet into the format it gets stored in, returns NULL if it can't
+//the alpha channel is kept if there is one, since quig would blend with it
+inline SDL_Surface* convertSprites(SDL_Surface *loaded) {
+	Uint32 format=loaded->format->Amask ? SDL_PIXELFORMAT_ARGB8888 : SDL_PIXELFORMAT_RGB888;
+	return SDL_ConvertSurfaceFormat(loaded, format, 0);
+}
+
+//add a converted sprite sheet's header and pixels to the end of a buffer
+inline void packSprites(SDL_Surface *converted, std::vector<unsigned char> &out) {
+	size_t start=out.size();
+	int pitch=converted->w*4;
+	out.resize(start+PAK_ALIGN+pitch*converted->h, 0);
+	Uint32 header[4]={(Uint32)converted->w, (Uint32)converted->h, (Uint32)pitch, converted->format->format};
+	for (int ii=0; ii<4; ii++) {
+		for (int bb=0; bb<4; bb++) {
+			out[start+ii*4+bb]=(header[ii] >> (bb*8)) & 0xFF;
+		}
+	}
+	for (int yy=0; yy<converted->h; yy++) {
+		memcpy(&out[start+PAK_ALIGN+yy*pitch], (Uint8*)converted->pixels+yy*converted->pitch, pitch);
+	}
+}
+
+//make a surface that uses packed pixels right where they are (no copy), returns NULL if they're damaged
+//the pixels have to stay around for as long as the surface does
+inline SDL_Surface* unpackSprites(const unsigned char *data, size_t size) {
+	if (size < (size_t)PAK_ALIGN) {
+		return NULL;
+	}
+	int w=(int)pakGetU32(data);
+	int h=(int)pakGetU32(data+4);
+	int pitch=(int)pakGetU32(data+8);
+	Uint32 format=pakGetU32(data+12);
+	if (w <= 0 || h <= 0 || w > PAK_SPRITES_MAX || h > PAK_SPRITES_MAX || (unsigned long long)(unsigned int)pitch < (unsigned long long)w*4 || SDL_BYTESPERPIXEL(format) != 4 || (unsigned long long)(unsigned int)pitch*h > size-PAK_ALIGN) {
+		return NULL;
+	}
+	return SDL_CreateRGBSurfaceWithFormatFrom((void*)(data+PAK_ALIGN), w, h, 32, pitch, format);
+}
+
+#endif